@@ -5,6 +5,7 @@ layout( location = 0 ) in vec3 iPosition;
 layout( location = 1 ) in vec3 iColor;
 layout( location = 2 ) in vec3 iNormal;
 layout( location = 3 ) in vec2 iTexCoord;
+layout( location = 4 ) in mat4 iModel2World; // per instance, locations 4-7
 layout( location = 3 ) uniform mat3 uNormalMatrix;
 
 out vec3 v2fColor;
@@ -14,7 +15,10 @@ out vec2 v2fTexCoord;
 void main()
 {
     v2fColor = iColor;
-    gl_Position = uProjCameraWorld * vec4( iPosition, 1.0 );
-    v2fNormal = normalize(uNormalMatrix * iNormal);
+    gl_Position = uProjCameraWorld * iModel2World * vec4( iPosition, 1.0 );
+
+    // Instance transforms are rigid (rotation and translation), so their
+    // upper 3x3 part transforms normals correctly.
+    v2fNormal = normalize(uNormalMatrix * mat3(iModel2World) * iNormal);
     v2fTexCoord = iTexCoord;
 }
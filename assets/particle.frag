@@ -1,10 +1,10 @@
 #version 430
 
-layout (location = 0) out vec4 oColor;
+in vec4 v2fColor;
 
-layout (location = 2) uniform vec4 uColor;
+layout (location = 0) out vec4 oColor;
 
 void main()
 {
-	oColor = uColor;
+	oColor = v2fColor;
 }
@@ -2,10 +2,72 @@
 
 layout (location = 0) in vec3 iPosition;
 
+// Per instance
+layout (location = 1) in vec4 iCenterSize; // world-space center, size
+layout (location = 2) in vec4 iColor;
+layout (location = 3) in float iRotation; // about the x, y and z axes
+layout (location = 4) in uint iEmitter;
+
 layout ( location = 0 ) uniform mat4 uProjCameraWorld;
-layout ( location = 1 ) uniform mat4 uTransform;
+
+// Billboards (see ParticleSystem::SetShapeUniforms())
+layout ( location = 2 ) uniform bool uBillboard;
+layout ( location = 3 ) uniform vec3 uCameraRight;
+layout ( location = 4 ) uniform vec3 uCameraUp;
+
+// Resolution of the emitters being drawn; -1 draws all emitters (see
+// ParticleSystem::Render())
+layout ( location = 6 ) uniform int uResolution;
+
+// Per-emitter settings (see ParticleEmitterParams)
+struct Emitter
+{
+	vec4 tint;
+	float sizeScale;
+	uint resolution; // see ParticleResolution
+};
+
+layout (std430, binding = 6) readonly buffer Emitters { Emitter emitters[]; };
+
+out vec4 v2fColor;
+out vec2 v2fTexCoord;
 
 void main()
 {
-	gl_Position = uProjCameraWorld * uTransform * vec4(iPosition, 1.0);
+	Emitter emitter = emitters[iEmitter];
+	// Particles of emitters drawn in another pass collapse to a point
+	if (uResolution >= 0 && emitter.resolution != uint(uResolution))
+	{
+		v2fColor = vec4(0.0);
+		v2fTexCoord = vec2(0.0);
+		gl_Position = vec4(0.0);
+		return;
+	}
+
+	float c = cos(iRotation);
+	float s = sin(iRotation);
+
+	vec3 offset;
+	if (uBillboard)
+	{
+		// Quad spun in the view plane
+		vec2 corner = mat2(c, s, -s, c) * iPosition.xy;
+		offset = uCameraRight * corner.x + uCameraUp * corner.y;
+		v2fTexCoord = step(0.0, iPosition.xy); // 0 or 1 at the corners, see kParticleShapeSize
+	}
+	else
+	{
+		// Same as make_rotation_x() * make_rotation_y() * make_rotation_z()
+		// (matrices are constructed column by column)
+		mat3 rx = mat3(1.0, 0.0, 0.0, 0.0, c, s, 0.0, -s, c);
+		mat3 ry = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+		mat3 rz = mat3(c, s, 0.0, -s, c, 0.0, 0.0, 0.0, 1.0);
+		offset = rx * ry * rz * iPosition;
+		v2fTexCoord = vec2(0.0);
+	}
+
+	vec3 world = iCenterSize.xyz + offset * iCenterSize.w * emitter.sizeScale;
+
+	v2fColor = iColor * emitter.tint;
+	gl_Position = uProjCameraWorld * vec4(world, 1.0);
 }
@@ -0,0 +1,132 @@
+#version 430
+
+// Stateless particles (ParticleSimulation::analytic). Each instance holds
+// the particle's spawn time, seed and emitter settings, written once when
+// the particle is spawned. Its state at uTime is evaluated from these in
+// closed form, so nothing is updated or uploaded per frame.
+//
+// Spawn times are relative to the particle's epoch, which keeps them
+// precise as the time grows (see ParticleSystem::kEpochLength). The two
+// current epochs alternate between two slots of uTime and uEpochs.
+
+layout (location = 0) in vec3 iPosition;
+
+// Per instance
+layout (location = 1) in vec4 iPositionSpawn;          // xyz: position, w: spawn time in the epoch
+layout (location = 2) in vec4 iPositionVariationLife;  // xyz: position variation, w: life time
+layout (location = 3) in vec4 iVelocitySizeBegin;      // xyz: velocity, w: begin size
+layout (location = 4) in vec4 iVelocityVariationSizeEnd; // xyz: velocity variation, w: end size
+layout (location = 5) in vec4 iColorBegin;
+layout (location = 6) in vec4 iColorEnd;
+layout (location = 7) in float iSizeVariation;
+layout (location = 8) in uint iSeed;
+layout (location = 9) in uint iEmitter;
+layout (location = 10) in uint iEpoch;
+
+layout ( location = 0 ) uniform mat4 uProjCameraWorld;
+layout ( location = 1 ) uniform vec2 uTime; // since the start of the epoch in each slot
+
+// Billboards (see ParticleSystem::SetShapeUniforms())
+layout ( location = 2 ) uniform bool uBillboard;
+layout ( location = 3 ) uniform vec3 uCameraRight;
+layout ( location = 4 ) uniform vec3 uCameraUp;
+
+layout ( location = 5 ) uniform uvec2 uEpochs; // epoch in each slot
+
+// Resolution of the emitters being drawn; -1 draws all emitters (see
+// ParticleSystem::Render())
+layout ( location = 6 ) uniform int uResolution;
+
+// Per-emitter settings (see ParticleEmitterParams)
+struct Emitter
+{
+	vec4 tint;
+	float sizeScale;
+	uint resolution; // see ParticleResolution
+};
+
+layout (std430, binding = 6) readonly buffer Emitters { Emitter emitters[]; };
+
+out vec4 v2fColor;
+out vec2 v2fTexCoord;
+
+// PCG hash (Jarzynski & Olano, "Hash Functions for GPU Rendering")
+uint pcg_hash( uint v )
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// The k-th of the particle's random numbers, in [0, 1). Uses the same
+// assignment as ParticleSystem::MakeParticle().
+float random01( uint k )
+{
+	return float(pcg_hash(iSeed * 8u + k) >> 8u) * (1.0 / 16777216.0);
+}
+
+void main()
+{
+	uint slot = iEpoch & 1u;
+	float age = uTime[slot] - iPositionSpawn.w;
+	float lifeTime = iPositionVariationLife.w;
+
+	// Dead particles collapse to a point, so that their triangles are
+	// culled. Particles of an epoch that ended have all died.
+	if (iEpoch != uEpochs[slot] || age < 0.0 || age >= lifeTime)
+	{
+		v2fColor = vec4(0.0);
+		v2fTexCoord = vec2(0.0);
+		gl_Position = vec4(0.0);
+		return;
+	}
+
+	Emitter emitter = emitters[iEmitter];
+	// Particles of emitters drawn in another pass collapse to a point
+	if (uResolution >= 0 && emitter.resolution != uint(uResolution))
+	{
+		v2fColor = vec4(0.0);
+		v2fTexCoord = vec2(0.0);
+		gl_Position = vec4(0.0);
+		return;
+	}
+
+	vec3 r0 = vec3(random01(0u), random01(1u), random01(2u)) - 0.5;
+	vec3 r1 = vec3(random01(4u), random01(5u), random01(6u)) - 0.5;
+
+	vec3 position = iPositionSpawn.xyz + iPositionVariationLife.xyz * r0;
+	vec3 velocity = iVelocitySizeBegin.xyz + iVelocityVariationSizeEnd.xyz * r1;
+	float rotation = random01(3u) * 2.0 * 3.14 + 0.01 * age;
+	float sizeBegin = iVelocitySizeBegin.w - iSizeVariation + iSizeVariation * random01(7u);
+
+	// Fade away particles
+	float life = 1.0 - age / lifeTime;
+	float size = mix(iVelocityVariationSizeEnd.w, sizeBegin, life);
+
+	float c = cos(rotation);
+	float s = sin(rotation);
+
+	vec3 offset;
+	if (uBillboard)
+	{
+		// Quad spun in the view plane
+		vec2 corner = mat2(c, s, -s, c) * iPosition.xy;
+		offset = uCameraRight * corner.x + uCameraUp * corner.y;
+		v2fTexCoord = step(0.0, iPosition.xy); // 0 or 1 at the corners, see kParticleShapeSize
+	}
+	else
+	{
+		// Same as make_rotation_x() * make_rotation_y() * make_rotation_z()
+		// (matrices are constructed column by column)
+		mat3 rx = mat3(1.0, 0.0, 0.0, 0.0, c, s, 0.0, -s, c);
+		mat3 ry = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+		mat3 rz = mat3(c, s, 0.0, -s, c, 0.0, 0.0, 0.0, 1.0);
+		offset = rx * ry * rz * iPosition;
+		v2fTexCoord = vec2(0.0);
+	}
+
+	vec3 world = position + velocity * age + offset * size * emitter.sizeScale;
+
+	v2fColor = mix(iColorEnd, iColorBegin, life) * emitter.tint;
+	gl_Position = uProjCameraWorld * vec4(world, 1.0);
+}
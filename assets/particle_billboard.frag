@@ -0,0 +1,14 @@
+#version 430
+
+in vec4 v2fColor;
+in vec2 v2fTexCoord;
+
+layout (binding = 0) uniform sampler2D uTexture;
+
+layout (location = 0) out vec4 oColor;
+
+void main()
+{
+	// The sprite is an alpha mask only (see ParticleSystem::CreateSpriteTexture())
+	oColor = vec4(v2fColor.rgb, v2fColor.a * texture(uTexture, v2fTexCoord).a);
+}
@@ -0,0 +1,87 @@
+#version 430
+
+// Particles simulated on the GPU (see particle_update.comp). Each instance
+// reads its particle from the pool.
+
+layout (location = 0) in vec3 iPosition;
+
+struct Particle
+{
+	vec4 positionLife;     // xyz: position, w: remaining life time
+	vec4 velocityLifeTime; // xyz: velocity, w: total life time
+	vec4 colorBegin;
+	vec4 colorEnd;
+	vec4 sizeRotation;     // x: begin size, y: end size, z: rotation, w: emitter + 1 (0: dead)
+};
+
+layout (std430, binding = 0) readonly buffer Particles { Particle particles[]; };
+layout (std430, binding = 2) readonly buffer AliveList { uint aliveIndices[]; };
+
+layout ( location = 0 ) uniform mat4 uProjCameraWorld;
+
+// Billboards (see ParticleSystem::SetShapeUniforms())
+layout ( location = 2 ) uniform bool uBillboard;
+layout ( location = 3 ) uniform vec3 uCameraRight;
+layout ( location = 4 ) uniform vec3 uCameraUp;
+
+// Resolution of the emitters being drawn; -1 draws all emitters (see
+// ParticleSystem::Render())
+layout ( location = 6 ) uniform int uResolution;
+
+// Per-emitter settings (see ParticleEmitterParams)
+struct Emitter
+{
+	vec4 tint;
+	float sizeScale;
+	uint resolution; // see ParticleResolution
+};
+
+layout (std430, binding = 6) readonly buffer Emitters { Emitter emitters[]; };
+
+out vec4 v2fColor;
+out vec2 v2fTexCoord;
+
+void main()
+{
+	Particle p = particles[aliveIndices[gl_InstanceID]];
+	Emitter emitter = emitters[uint(p.sizeRotation.w) - 1u];
+	// Particles of emitters drawn in another pass collapse to a point
+	if (uResolution >= 0 && emitter.resolution != uint(uResolution))
+	{
+		v2fColor = vec4(0.0);
+		v2fTexCoord = vec2(0.0);
+		gl_Position = vec4(0.0);
+		return;
+	}
+
+	// Fade away particles
+	float life = p.positionLife.w / p.velocityLifeTime.w;
+	float size = mix(p.sizeRotation.y, p.sizeRotation.x, life);
+
+	float c = cos(p.sizeRotation.z);
+	float s = sin(p.sizeRotation.z);
+
+	vec3 offset;
+	if (uBillboard)
+	{
+		// Quad spun in the view plane
+		vec2 corner = mat2(c, s, -s, c) * iPosition.xy;
+		offset = uCameraRight * corner.x + uCameraUp * corner.y;
+		v2fTexCoord = step(0.0, iPosition.xy); // 0 or 1 at the corners, see kParticleShapeSize
+	}
+	else
+	{
+		// Same as make_rotation_x() * make_rotation_y() * make_rotation_z()
+		// (matrices are constructed column by column)
+		mat3 rx = mat3(1.0, 0.0, 0.0, 0.0, c, s, 0.0, -s, c);
+		mat3 ry = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+		mat3 rz = mat3(c, s, 0.0, -s, c, 0.0, 0.0, 0.0, 1.0);
+		offset = rx * ry * rz * iPosition;
+		v2fTexCoord = vec2(0.0);
+	}
+
+	vec3 world = p.positionLife.xyz + offset * size * emitter.sizeScale;
+
+	v2fColor = mix(p.colorEnd, p.colorBegin, life) * emitter.tint;
+	gl_Position = uProjCameraWorld * vec4(world, 1.0);
+}
@@ -0,0 +1,29 @@
+#version 430
+
+// Reduces the framebuffer's depth to the nearest depth of each block of
+// uFactor x uFactor pixels (see ParticleOffscreen::begin()). Taking the
+// nearest keeps particles from being drawn over the edges of nearer
+// geometry; the upsample recovers them where the block's farther pixels
+// see them.
+
+layout (binding = 0) uniform sampler2D uDepth; // full resolution
+
+layout (location = 0) uniform int uFactor;
+
+void main()
+{
+	ivec2 last = textureSize(uDepth, 0) - 1;
+	ivec2 first = ivec2(gl_FragCoord.xy) * uFactor;
+
+	float depth = 1.0;
+	for (int y = 0; y < uFactor; ++y)
+	{
+		for (int x = 0; x < uFactor; ++x)
+		{
+			ivec2 pixel = min(first + ivec2(x, y), last);
+			depth = min(depth, texelFetch(uDepth, pixel, 0).r);
+		}
+	}
+
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,57 @@
+#version 430
+
+// Bilateral upsample of the off-screen particles (see ParticleOffscreen).
+// Each pixel blends the four nearest low resolution texels. Their bilinear
+// weights are scaled down by the difference between their depth and the
+// pixel's own, so that texels which lie across a silhouette contribute
+// little.
+
+layout (binding = 0) uniform sampler2D uColor; // rgb: premultiplied, a: transmittance
+layout (binding = 1) uniform sampler2D uDepth;
+layout (binding = 2) uniform sampler2D uFullDepth;
+
+layout (location = 0) uniform int uFactor;
+layout (location = 1) uniform ivec2 uOrigin; // of the viewport
+
+layout (location = 0) out vec4 oColor;
+
+// Depth difference (window space) below which texels count as equally near
+const float kDepthEpsilon = 1e-4;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy) - uOrigin;
+	float depth = texelFetch(uFullDepth, pixel, 0).r;
+
+	// Position relative to the centers of the low resolution texels
+	vec2 position = (vec2(pixel) + 0.5) / float(uFactor) - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+
+	ivec2 last = textureSize(uColor, 0) - 1;
+
+	vec4 sum = vec4(0.0);
+	float weights = 0.0;
+	bool empty = true;
+	for (int i = 0; i < 4; ++i)
+	{
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 texel = clamp(base + offset, ivec2(0), last);
+
+		vec4 color = texelFetch(uColor, texel, 0);
+		empty = empty && 1.0 == color.a;
+
+		vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+		float weight = bilinear.x * bilinear.y
+			/ (kDepthEpsilon + abs(texelFetch(uDepth, texel, 0).r - depth));
+
+		sum += weight * color;
+		weights += weight;
+	}
+
+	// No particle near this pixel
+	if (empty)
+		discard;
+
+	oColor = sum / weights;
+}
@@ -0,0 +1,28 @@
+#version 430
+
+// Particles drawn into a ParticleOit pass (weighted blended OIT)
+
+in vec4 v2fColor;
+in vec2 v2fTexCoord;
+
+layout (location = 2) uniform bool uBillboard;
+layout (binding = 0) uniform sampler2D uTexture;
+
+layout (location = 0) out vec4 oAccumulation;
+layout (location = 1) out float oRevealage;
+
+void main()
+{
+	vec4 color = v2fColor;
+	if (uBillboard)
+		color.a *= texture(uTexture, v2fTexCoord).a; // alpha mask
+
+	// Depth weight, eq. (7) of McGuire & Bavoil, "Weighted Blended
+	// Order-Independent Transparency" (2013); gl_FragCoord.w is one over
+	// the view-space distance
+	float z = 1.0 / gl_FragCoord.w;
+	float weight = color.a * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+
+	oAccumulation = vec4(color.rgb * color.a, color.a) * weight;
+	oRevealage = color.a;
+}
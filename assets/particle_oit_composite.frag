@@ -0,0 +1,24 @@
+#version 430
+
+// Resolves weighted blended OIT (see ParticleOit). The targets have the
+// framebuffer's size, so they are read at the fragment's own pixel.
+
+layout (binding = 0) uniform sampler2D uAccumulation;
+layout (binding = 1) uniform sampler2D uRevealage;
+
+layout (location = 0) out vec4 oColor;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+	float revealage = texelFetch(uRevealage, pixel, 0).r;
+	if (1.0 == revealage)
+		discard;
+
+	vec4 accumulation = texelFetch(uAccumulation, pixel, 0);
+
+	// Weighted average color; blended with alpha = 1 - revealage
+	vec3 color = accumulation.rgb / max(accumulation.a, 1e-5);
+	oColor = vec4(color, 1.0 - revealage);
+}
@@ -0,0 +1,10 @@
+#version 430
+
+// Full-screen triangle, from the vertex index alone (see ParticleOit::end()
+// and ParticleOffscreen)
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,98 @@
+// Converts Wavefront OBJ meshes (with their .mtl materials) into the
+// pre-baked .smesh format (see main/smesh.hpp).
+//
+// Usage: loadobj [--interleaved] <input.obj> [output.smesh]
+//
+// If no output path is given, the output is written next to the input, with
+// the extension replaced by .smesh. With --interleaved, the vertices are
+// stored in the interleaved layout (see VertexLayout), which the program
+// then uploads from the file without a copy. The mesh's LOD chains (see
+// main/mesh_lod.hpp; one per chunk for large meshes) are built and stored
+// with it, and its indices and vertices are reordered for the GPU's vertex
+// cache (see main/mesh_optimize.hpp).
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../main/loadobj.hpp"
+#include "../main/mesh_lod.hpp"
+#include "../main/mesh_optimize.hpp"
+#include "../main/smesh.hpp"
+
+int main(int aArgc, char *aArgv[]) try {
+  char const *const program = aArgv[0];
+
+  VertexLayout layout = VertexLayout::separate;
+  if (aArgc > 1 && 0 == std::strcmp(aArgv[1], "--interleaved")) {
+    layout = VertexLayout::interleaved;
+    --aArgc;
+    ++aArgv;
+  }
+
+  if (aArgc < 2 || aArgc > 3) {
+    std::fprintf(stderr,
+                 "Usage: %s [--interleaved] <input.obj> [output.smesh]\n",
+                 program);
+    return 2;
+  }
+
+  std::string const input = aArgv[1];
+  std::string output;
+
+  if (3 == aArgc) {
+    output = aArgv[2];
+  } else {
+    auto const dot = input.find_last_of('.');
+    auto const slash = input.find_last_of("/\\");
+    bool const hasExt =
+        std::string::npos != dot &&
+        (std::string::npos == slash || dot > slash);
+    output = (hasExt ? input.substr(0, dot) : input) + ".smesh";
+  }
+
+  auto mesh = load_wavefront_obj(input.c_str());
+  build_lod_chunks(mesh);
+
+  std::vector<float> acmrBefore;
+  for (auto const &lod : mesh.lods) {
+    acmrBefore.push_back(compute_acmr(mesh.indices.data() + lod.firstIndex,
+                                      lod.indexCount, mesh.positions.size()));
+  }
+
+  optimize_mesh(mesh);
+  save_smesh(output.c_str(), mesh, layout);
+
+  std::printf("%s -> %s: %zu vertices, %zu chunks\n", input.c_str(),
+              output.c_str(), mesh.positions.size(),
+              std::max<std::size_t>(1, mesh.chunks.size()));
+
+  std::vector<MeshChunk> chunks = mesh.chunks;
+  if (chunks.empty())
+    chunks.push_back({{}, 0, std::uint32_t(mesh.lods.size())});
+
+  for (std::size_t c = 0; c < chunks.size(); ++c) {
+    for (std::size_t l = 0; l < chunks[c].lodCount; ++l) {
+      std::size_t const i = chunks[c].firstLod + l;
+      auto const &lod = mesh.lods[i];
+      float const acmr = compute_acmr(mesh.indices.data() + lod.firstIndex,
+                                      lod.indexCount, mesh.positions.size());
+      std::printf("  chunk %zu, LOD %zu: %u indices, error %g, "
+                  "ACMR %.3f -> %.3f\n",
+                  c, l, unsigned(lod.indexCount), double(lod.error),
+                  double(acmrBefore[i]), double(acmr));
+    }
+  }
+
+  return 0;
+} catch (std::exception const &eErr) {
+  std::fprintf(stderr, "Top-level Exception (%s):\n", typeid(eErr).name());
+  std::fprintf(stderr, "%s\n", eErr.what());
+  std::fprintf(stderr, "Bye.\n");
+  return 1;
+}
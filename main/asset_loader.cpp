@@ -0,0 +1,263 @@
+#include "asset_loader.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+#include <cstdio>
+
+#include "loadobj.hpp"
+#include "mesh_lod.hpp"
+#include "mesh_optimize.hpp"
+#include "smesh.hpp"
+#include "texture.hpp"
+
+namespace {
+bool file_exists_(std::string const &aPath) {
+  if (std::FILE *f = std::fopen(aPath.c_str(), "rb")) {
+    std::fclose(f);
+    return true;
+  }
+  return false;
+}
+} // namespace
+
+template <typename tValue>
+void AssetLoader::publish_(AsyncResource<tValue> &aRes, tValue aValue,
+                           std::size_t aBytes) {
+  aRes.mValue = std::move(aValue);
+  aRes.mBytes = aBytes;
+
+  // The fence must reach the GPU before the render context waits on it
+  aRes.mFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+
+  aRes.mDone.store(true, std::memory_order_release);
+}
+
+template <typename tValue>
+void AssetLoader::publish_host_(AsyncResource<tValue> &aRes, tValue aValue,
+                                std::size_t aBytes) {
+  aRes.mValue = std::move(aValue);
+  aRes.mBytes = aBytes;
+  aRes.mDone.store(true, std::memory_order_release);
+}
+
+template <typename tValue>
+void AssetLoader::fail_(AsyncResource<tValue> &aRes, char const *aMessage) {
+  aRes.mError = aMessage;
+  aRes.mDone.store(true, std::memory_order_release);
+}
+
+AssetLoader::AssetLoader(GLFWwindow *aRenderWindow, unsigned aWorkerCount)
+    : mTextureFormats(query_compressed_format_support()) {
+  // Hidden window, only used for its context. The current hints still hold
+  // the context version/profile that the render window was created with.
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  mUploadWindow = glfwCreateWindow(1, 1, "", nullptr, aRenderWindow);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+  if (!mUploadWindow) {
+    char const *msg = nullptr;
+    int ecode = glfwGetError(&msg);
+    throw Error("glfwCreateWindow() failed for upload context with '%s' (%d)",
+                msg, ecode);
+  }
+
+  unsigned const cores = std::max(1u, std::thread::hardware_concurrency());
+  if (0 == aWorkerCount) {
+    // Leave one core each to the render and upload threads
+    aWorkerCount = cores > 2 ? cores - 2 : 1;
+  }
+  mObjThreads = std::max(1u, cores / aWorkerCount);
+
+  mUploader = std::thread(&AssetLoader::run_uploader_, this);
+
+  for (unsigned i = 0; i < aWorkerCount; ++i)
+    mWorkers.emplace_back(&AssetLoader::run_worker_, this);
+}
+
+AssetLoader::~AssetLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mDecodeCV.notify_all();
+  mUploadCV.notify_all();
+
+  for (auto &worker : mWorkers)
+    worker.join();
+  mUploader.join();
+
+  // The upload thread has released its context by now
+  glfwDestroyWindow(mUploadWindow);
+}
+
+std::shared_ptr<AsyncResource<GLuint>>
+AssetLoader::request_texture_2d(std::string aPath) {
+  auto res = std::make_shared<AsyncResource<GLuint>>();
+
+  enqueue_decode_([this, res, path = std::move(aPath)] {
+    // The decoded images are move-only, whereas std::function requires
+    // copyable callables; share the image with the upload job instead.
+    try {
+      if (mTextureFormats.s3tc || mTextureFormats.bptc) {
+        auto image = std::make_shared<CompressedImage>(
+            load_compressed_image(path.c_str(), mTextureFormats));
+
+        enqueue_upload_([res, image] {
+          try {
+            publish_(*res, create_texture_2d(*image), image->data.size());
+          } catch (std::exception const &eErr) {
+            fail_(*res, eErr.what());
+          }
+        });
+      } else {
+        auto image =
+            std::make_shared<ImageRGBA8>(load_image_rgba8(path.c_str()));
+
+        // RGBA8, plus a third for the mip levels
+        std::size_t const bytes =
+            std::size_t(image->width) * image->height * 4 * 4 / 3;
+
+        enqueue_upload_([res, image, bytes] {
+          try {
+            publish_(*res, create_texture_2d(*image), bytes);
+          } catch (std::exception const &eErr) {
+            fail_(*res, eErr.what());
+          }
+        });
+      }
+    } catch (std::exception const &eErr) {
+      fail_(*res, eErr.what());
+    }
+  });
+
+  return res;
+}
+
+std::shared_ptr<AsyncResource<std::shared_ptr<CompressedImage const>>>
+AssetLoader::request_compressed_image(std::string aPath) {
+  auto res =
+      std::make_shared<AsyncResource<std::shared_ptr<CompressedImage const>>>();
+
+  enqueue_decode_([this, res, path = std::move(aPath)] {
+    try {
+      auto image = std::make_shared<CompressedImage>(
+          load_compressed_image(path.c_str(), mTextureFormats));
+
+      std::size_t const bytes = image->data.size();
+      publish_host_(*res, std::shared_ptr<CompressedImage const>(image), bytes);
+    } catch (std::exception const &eErr) {
+      fail_(*res, eErr.what());
+    }
+  });
+
+  return res;
+}
+
+bool AssetLoader::supports_compressed_textures() const noexcept {
+  return mTextureFormats.s3tc || mTextureFormats.bptc;
+}
+
+std::shared_ptr<AsyncResource<SimpleMeshBuffers>>
+AssetLoader::request_mesh(std::string aSmeshPath, std::string aObjPath,
+                          VertexLayout aLayout) {
+  auto res = std::make_shared<AsyncResource<SimpleMeshBuffers>>();
+
+  // A pre-baked mesh needs no decoding; the upload thread maps it and
+  // uploads from the mapping directly.
+  if (file_exists_(aSmeshPath)) {
+    enqueue_upload_([res, aLayout, path = std::move(aSmeshPath)] {
+      try {
+        auto const buffers = load_smesh_buffers(path.c_str(), aLayout);
+        publish_(*res, buffers, mesh_buffer_bytes(buffers));
+      } catch (std::exception const &eErr) {
+        fail_(*res, eErr.what());
+      }
+    });
+    return res;
+  }
+
+  enqueue_decode_([this, res, aLayout, path = std::move(aObjPath)] {
+    std::shared_ptr<SimpleMeshData> mesh;
+    try {
+      mesh = std::make_shared<SimpleMeshData>(
+          load_wavefront_obj(path.c_str(), mObjThreads));
+      build_lod_chunks(*mesh);
+      optimize_mesh(*mesh);
+    } catch (std::exception const &eErr) {
+      fail_(*res, eErr.what());
+      return;
+    }
+
+    enqueue_upload_([res, aLayout, mesh] {
+      try {
+        auto const buffers = create_mesh_buffers(*mesh, aLayout);
+        publish_(*res, buffers, mesh_buffer_bytes(buffers));
+      } catch (std::exception const &eErr) {
+        fail_(*res, eErr.what());
+      }
+    });
+  });
+
+  return res;
+}
+
+void AssetLoader::enqueue_decode_(Job_ aJob) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDecodeJobs.emplace_back(std::move(aJob));
+  }
+  mDecodeCV.notify_one();
+}
+
+void AssetLoader::enqueue_upload_(Job_ aJob) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mUploadJobs.emplace_back(std::move(aJob));
+  }
+  mUploadCV.notify_one();
+}
+
+void AssetLoader::run_worker_() {
+  for (;;) {
+    Job_ job;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mDecodeCV.wait(lock, [this] { return mStop || !mDecodeJobs.empty(); });
+
+      if (mStop)
+        return;
+
+      job = std::move(mDecodeJobs.front());
+      mDecodeJobs.pop_front();
+    }
+
+    job();
+  }
+}
+
+void AssetLoader::run_uploader_() {
+  glfwMakeContextCurrent(mUploadWindow);
+
+  for (;;) {
+    Job_ job;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mUploadCV.wait(lock, [this] { return mStop || !mUploadJobs.empty(); });
+
+      if (mStop)
+        break;
+
+      job = std::move(mUploadJobs.front());
+      mUploadJobs.pop_front();
+    }
+
+    job();
+  }
+
+  glfwMakeContextCurrent(nullptr);
+}
@@ -0,0 +1,192 @@
+#ifndef ASSET_LOADER_HPP_8E2F4C1A_6B3D_4E7A_A5C9_1D0B7F3E6A24
+#define ASSET_LOADER_HPP_8E2F4C1A_6B3D_4E7A_A5C9_1D0B7F3E6A24
+
+#include <glad.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simple_mesh.hpp"
+#include "compressed_texture.hpp"
+
+#include "../support/error.hpp"
+
+struct GLFWwindow;
+
+/* Resource that is loaded in the background by an AssetLoader.
+ *
+ * The loader fills in the value from its upload context and inserts a fence
+ * after the upload commands. ready() polls that fence without blocking; once
+ * it returns true, the GL objects in value() may be used in the render
+ * context.
+ *
+ * ready() and value() may only be called from the render thread.
+ */
+template< typename tValue >
+class AsyncResource final
+{
+	public:
+		// Throws an Error if loading failed.
+		bool ready();
+
+		tValue const& value() const noexcept;
+
+		// Memory held by the value in bytes: GPU memory for GL objects,
+		// host memory otherwise. Zero until ready() has returned true.
+		std::size_t bytes() const noexcept;
+
+	private:
+		friend class AssetLoader;
+
+		// Written by the loader before mDone is set
+		tValue mValue{};
+		GLsync mFence = nullptr; // null if the value has no GL objects
+		std::size_t mBytes = 0;
+		std::string mError;
+
+		std::atomic<bool> mDone{ false };
+
+		bool mReady = false;
+};
+
+/* Background asset loader
+ *
+ * Worker threads decode images and parse meshes in parallel. A separate
+ * upload thread owns a hidden window whose context shares objects with the
+ * render context; it creates the buffers and textures and fences them.
+ *
+ * Only objects that are shared between contexts (buffers, textures) are
+ * created by the loader. Container objects such as VAOs must be created by
+ * the render thread once a mesh is ready (see create_vao(SimpleMeshBuffers)).
+ */
+class AssetLoader final
+{
+	public:
+		// Must be called from the main thread, with the context of
+		// aRenderWindow current. The upload context is created with the
+		// current GLFW window hints (i.e., those used for aRenderWindow).
+		// aWorkerCount = 0 picks a count based on the number of cores.
+		explicit AssetLoader( GLFWwindow* aRenderWindow, unsigned aWorkerCount = 0 );
+
+		// Stops all threads (pending requests are dropped) and destroys the
+		// upload context. Must be called from the main thread.
+		~AssetLoader();
+
+		AssetLoader( AssetLoader const& ) = delete;
+		AssetLoader& operator= (AssetLoader const&) = delete;
+
+	public:
+		// Mipmapped sRGB texture, compressed if possible (see load_texture_2d())
+		std::shared_ptr<AsyncResource<GLuint>> request_texture_2d( std::string aPath );
+
+		// Compressed image with all mip levels, for use with a
+		// StreamingTexture. Requires support for a compressed format (see
+		// supports_compressed_textures()). No GL objects are created, so the
+		// result is ready as soon as it has been loaded.
+		std::shared_ptr<AsyncResource<std::shared_ptr<CompressedImage const>>> request_compressed_image( std::string aPath );
+
+		bool supports_compressed_textures() const noexcept;
+
+		// Indexed mesh. Uses the pre-baked .smesh if it exists, and parses
+		// the OBJ (and builds its LOD chunks and optimises its vertex order)
+		// otherwise.
+		std::shared_ptr<AsyncResource<SimpleMeshBuffers>> request_mesh(
+			std::string aSmeshPath,
+			std::string aObjPath,
+			VertexLayout = VertexLayout::separate
+		);
+
+	private:
+		// Jobs must not throw; they report errors through their
+		// AsyncResource (see fail_())
+		using Job_ = std::function<void()>;
+
+		void enqueue_decode_( Job_ );
+		void enqueue_upload_( Job_ );
+
+		void run_worker_();
+		void run_uploader_();
+
+		template< typename tValue >
+		static void publish_( AsyncResource<tValue>&, tValue, std::size_t aBytes );
+
+		// As publish_(), for values that do not involve any GL objects
+		template< typename tValue >
+		static void publish_host_( AsyncResource<tValue>&, tValue, std::size_t aBytes );
+
+		template< typename tValue >
+		static void fail_( AsyncResource<tValue>&, char const* aMessage );
+
+	private:
+		GLFWwindow* mUploadWindow = nullptr;
+
+		// Compressed formats of the render context (queried once, so that
+		// the workers can compress textures without a context)
+		CompressedFormatSupport mTextureFormats;
+
+		std::mutex mMutex;
+		std::condition_variable mDecodeCV, mUploadCV;
+		std::deque<Job_> mDecodeJobs, mUploadJobs;
+		bool mStop = false;
+
+		std::vector<std::thread> mWorkers;
+		std::thread mUploader;
+
+		// Threads per OBJ conversion (see load_wavefront_obj()). The workers
+		// share the cores, rather than each spawning one thread per core.
+		std::size_t mObjThreads = 1;
+};
+
+template< typename tValue > inline
+bool AsyncResource<tValue>::ready()
+{
+	if( mReady )
+		return true;
+
+	if( !mDone.load( std::memory_order_acquire ) )
+		return false;
+
+	if( !mError.empty() )
+		throw Error( "%s", mError.c_str() );
+
+	// Poll the fence (zero timeout). Values without GL objects are not
+	// fenced.
+	if( !mFence )
+	{
+		mReady = true;
+		return true;
+	}
+
+	auto const res = glClientWaitSync( mFence, 0, 0 );
+	if( GL_TIMEOUT_EXPIRED == res )
+		return false;
+	if( GL_WAIT_FAILED == res )
+		throw Error( "glClientWaitSync() failed on asset fence" );
+
+	glDeleteSync( mFence );
+	mFence = nullptr;
+
+	mReady = true;
+	return true;
+}
+
+template< typename tValue > inline
+tValue const& AsyncResource<tValue>::value() const noexcept
+{
+	return mValue;
+}
+
+template< typename tValue > inline
+std::size_t AsyncResource<tValue>::bytes() const noexcept
+{
+	return mReady ? mBytes : 0;
+}
+
+#endif // ASSET_LOADER_HPP_8E2F4C1A_6B3D_4E7A_A5C9_1D0B7F3E6A24
@@ -0,0 +1,617 @@
+#include "compressed_texture.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "texture.hpp"
+
+#include "../support/error.hpp"
+
+namespace {
+// Pixels of one 4x4 block, row by row
+using Block_ = std::array<std::array<std::uint8_t, 4>, 16>;
+
+struct Mip_ {
+  int width, height;
+  std::vector<std::uint8_t> rgba;
+};
+
+std::vector<Mip_> build_mip_chain_(ImageRGBA8 const &);
+
+Block_ fetch_block_(Mip_ const &, int aBlockX, int aBlockY);
+
+void encode_bc1_(Block_ const &, std::uint8_t *aOut);
+void encode_bc3_(Block_ const &, std::uint8_t *aOut);
+void encode_bc7_(Block_ const &, std::uint8_t *aOut);
+
+// Compressed texture cache (see set_texture_cache())
+std::string &texture_cache_dir_() {
+  static std::string dir;
+  return dir;
+}
+
+// Cache file layout: header, then each level's size (std::uint32_t) followed
+// by the level's data. Level dimensions follow from the base size.
+struct CtexHeader_ {
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t format;
+  std::uint32_t width, height;
+  std::uint32_t levelCount;
+
+  // Identifies the source file that the entry was made from
+  std::uint64_t sourceSize;
+  std::int64_t sourceTime;
+};
+
+static_assert(sizeof(CtexHeader_) == 40, "unexpected padding in header");
+
+constexpr char kCtexMagic_[4] = {'C', 'T', 'E', 'X'};
+constexpr std::uint32_t kCtexVersion_ = 1;
+
+std::string cache_path_(char const *aPath);
+
+bool read_cached_(std::string const &aCachePath, CtexHeader_ const &aExpected,
+                  CompressedFormatSupport, CompressedImage &aOut);
+void write_cached_(std::string const &aCachePath, CtexHeader_ const &,
+                   CompressedImage const &);
+} // namespace
+
+CompressedImage compress_image(ImageRGBA8 const &aImage,
+                               CompressedFormatSupport aSupport) {
+  if (!aSupport.s3tc && !aSupport.bptc)
+    throw Error("compress_image(): no block-compressed format is supported");
+
+  bool opaque = true;
+  std::size_t const pixelCount = std::size_t(aImage.width) * aImage.height;
+  for (std::size_t i = 0; i < pixelCount && opaque; ++i)
+    opaque = 255 == aImage.pixels[i * 4 + 3];
+
+  CompressedImage ret;
+  ret.width = aImage.width;
+  ret.height = aImage.height;
+
+  std::size_t blockBytes = 16;
+  void (*encode)(Block_ const &, std::uint8_t *) = &encode_bc7_;
+  ret.format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+
+  if (opaque && aSupport.s3tc) {
+    ret.format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    encode = &encode_bc1_;
+    blockBytes = 8;
+  } else if (!opaque && !aSupport.bptc) {
+    ret.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    encode = &encode_bc3_;
+  }
+
+  auto const mips = build_mip_chain_(aImage);
+
+  std::size_t total = 0;
+  for (auto const &mip : mips) {
+    std::size_t const blocks =
+        std::size_t((mip.width + 3) / 4) * ((mip.height + 3) / 4);
+
+    ret.levels.push_back({mip.width, mip.height, total, blocks * blockBytes});
+    total += blocks * blockBytes;
+  }
+
+  ret.data.resize(total);
+
+  for (std::size_t l = 0; l < mips.size(); ++l) {
+    auto const &mip = mips[l];
+    std::uint8_t *out = ret.data.data() + ret.levels[l].offset;
+
+    for (int by = 0; by < (mip.height + 3) / 4; ++by) {
+      for (int bx = 0; bx < (mip.width + 3) / 4; ++bx) {
+        encode(fetch_block_(mip, bx, by), out);
+        out += blockBytes;
+      }
+    }
+  }
+
+  return ret;
+}
+
+CompressedImage load_compressed_image(char const *aPath,
+                                      CompressedFormatSupport aSupport) {
+  auto const cachePath = cache_path_(aPath);
+  if (cachePath.empty())
+    return compress_image(load_image_rgba8(aPath), aSupport);
+
+  CtexHeader_ stamp{};
+  std::memcpy(stamp.magic, kCtexMagic_, sizeof(stamp.magic));
+  stamp.version = kCtexVersion_;
+
+  std::error_code ec;
+  stamp.sourceSize = std::filesystem::file_size(aPath, ec);
+  stamp.sourceTime =
+      std::filesystem::last_write_time(aPath, ec).time_since_epoch().count();
+
+  CompressedImage ret;
+  if (!ec && read_cached_(cachePath, stamp, aSupport, ret))
+    return ret;
+
+  ret = compress_image(load_image_rgba8(aPath), aSupport);
+
+  if (!ec)
+    write_cached_(cachePath, stamp, ret);
+
+  return ret;
+}
+
+void set_texture_cache(char const *aDirectory) {
+  texture_cache_dir_() = aDirectory ? aDirectory : "";
+}
+
+namespace {
+// sRGB <-> linear conversion for mip generation
+float srgb_to_linear_(std::uint8_t aValue) {
+  static auto const table = [] {
+    std::array<float, 256> ret{};
+    for (std::size_t i = 0; i < 256; ++i) {
+      float const c = i / 255.f;
+      ret[i] = c <= 0.04045f ? c / 12.92f
+                             : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return ret;
+  }();
+  return table[aValue];
+}
+
+std::uint8_t linear_to_srgb_(float aValue) {
+  float const c = aValue <= 0.0031308f
+                      ? aValue * 12.92f
+                      : 1.055f * std::pow(aValue, 1.f / 2.4f) - 0.055f;
+  return std::uint8_t(std::clamp(c * 255.f + 0.5f, 0.f, 255.f));
+}
+
+std::vector<Mip_> build_mip_chain_(ImageRGBA8 const &aImage) {
+  std::vector<Mip_> mips;
+
+  Mip_ base{aImage.width, aImage.height, {}};
+  base.rgba.assign(aImage.pixels.get(),
+                   aImage.pixels.get() +
+                       std::size_t(aImage.width) * aImage.height * 4);
+  mips.emplace_back(std::move(base));
+
+  while (mips.back().width > 1 || mips.back().height > 1) {
+    auto const &src = mips.back();
+
+    Mip_ dst{std::max(1, src.width / 2), std::max(1, src.height / 2), {}};
+    dst.rgba.resize(std::size_t(dst.width) * dst.height * 4);
+
+    // 2x2 box filter; a source dimension of 1 is sampled twice
+    for (int y = 0; y < dst.height; ++y) {
+      int const y0 = std::min(2 * y, src.height - 1);
+      int const y1 = std::min(2 * y + 1, src.height - 1);
+
+      for (int x = 0; x < dst.width; ++x) {
+        int const x0 = std::min(2 * x, src.width - 1);
+        int const x1 = std::min(2 * x + 1, src.width - 1);
+
+        std::uint8_t const *taps[4] = {
+            &src.rgba[(std::size_t(y0) * src.width + x0) * 4],
+            &src.rgba[(std::size_t(y0) * src.width + x1) * 4],
+            &src.rgba[(std::size_t(y1) * src.width + x0) * 4],
+            &src.rgba[(std::size_t(y1) * src.width + x1) * 4]};
+
+        std::uint8_t *out = &dst.rgba[(std::size_t(y) * dst.width + x) * 4];
+        for (int c = 0; c < 3; ++c) {
+          float sum = 0.f;
+          for (auto const *tap : taps)
+            sum += srgb_to_linear_(tap[c]);
+          out[c] = linear_to_srgb_(sum * 0.25f);
+        }
+
+        unsigned const alpha = taps[0][3] + taps[1][3] + taps[2][3] + taps[3][3];
+        out[3] = std::uint8_t((alpha + 2) / 4);
+      }
+    }
+
+    mips.emplace_back(std::move(dst));
+  }
+
+  return mips;
+}
+
+Block_ fetch_block_(Mip_ const &aMip, int aBlockX, int aBlockY) {
+  // Blocks that extend past the edge of the image repeat the edge pixels
+  Block_ ret;
+  for (int y = 0; y < 4; ++y) {
+    int const sy = std::min(aBlockY * 4 + y, aMip.height - 1);
+    for (int x = 0; x < 4; ++x) {
+      int const sx = std::min(aBlockX * 4 + x, aMip.width - 1);
+      std::memcpy(ret[y * 4 + x].data(),
+                  &aMip.rgba[(std::size_t(sy) * aMip.width + sx) * 4], 4);
+    }
+  }
+  return ret;
+}
+
+// Endpoints of the line that best fits the block's pixels (first aChannels
+// channels). The line follows the principal axis through the mean; its ends
+// are the extreme projections of the pixels onto that axis.
+void fit_endpoints_(Block_ const &aBlock, int aChannels, float aLo[4],
+                    float aHi[4]) {
+  float mean[4] = {};
+  for (auto const &px : aBlock)
+    for (int c = 0; c < aChannels; ++c)
+      mean[c] += px[c] / 16.f;
+
+  float cov[4][4] = {};
+  for (auto const &px : aBlock) {
+    for (int i = 0; i < aChannels; ++i)
+      for (int j = 0; j < aChannels; ++j)
+        cov[i][j] += (px[i] - mean[i]) * (px[j] - mean[j]);
+  }
+
+  // Power iteration, starting from the diagonal of the bounding box
+  float axis[4] = {};
+  for (int c = 0; c < aChannels; ++c) {
+    float lo = 255.f, hi = 0.f;
+    for (auto const &px : aBlock) {
+      lo = std::min(lo, float(px[c]));
+      hi = std::max(hi, float(px[c]));
+    }
+    axis[c] = hi - lo;
+  }
+
+  for (int iter = 0; iter < 8; ++iter) {
+    float next[4] = {};
+    float len = 0.f;
+    for (int i = 0; i < aChannels; ++i) {
+      for (int j = 0; j < aChannels; ++j)
+        next[i] += cov[i][j] * axis[j];
+      len = std::max(len, std::abs(next[i]));
+    }
+
+    if (len <= 0.f)
+      break;
+
+    for (int i = 0; i < aChannels; ++i)
+      axis[i] = next[i] / len;
+  }
+
+  float norm2 = 0.f;
+  for (int c = 0; c < aChannels; ++c)
+    norm2 += axis[c] * axis[c];
+
+  float tLo = 0.f, tHi = 0.f;
+  if (norm2 > 0.f) {
+    tLo = 1e30f;
+    tHi = -1e30f;
+    for (auto const &px : aBlock) {
+      float t = 0.f;
+      for (int c = 0; c < aChannels; ++c)
+        t += (px[c] - mean[c]) * axis[c];
+      tLo = std::min(tLo, t / norm2);
+      tHi = std::max(tHi, t / norm2);
+    }
+  }
+
+  for (int c = 0; c < aChannels; ++c) {
+    aLo[c] = std::clamp(mean[c] + axis[c] * tLo, 0.f, 255.f);
+    aHi[c] = std::clamp(mean[c] + axis[c] * tHi, 0.f, 255.f);
+  }
+}
+
+// Index of the palette entry closest to each pixel
+template <std::size_t tCount>
+void pick_indices_(Block_ const &aBlock, int aChannels,
+                   std::array<std::array<int, 4>, tCount> const &aPalette,
+                   int aFirstChannel, int aIndices[16]) {
+  for (int i = 0; i < 16; ++i) {
+    int best = 0, bestErr = 1 << 30;
+    for (std::size_t p = 0; p < tCount; ++p) {
+      int err = 0;
+      for (int c = aFirstChannel; c < aFirstChannel + aChannels; ++c) {
+        int const d = aBlock[i][c] - aPalette[p][c];
+        err += d * d;
+      }
+      if (err < bestErr) {
+        bestErr = err;
+        best = int(p);
+      }
+    }
+    aIndices[i] = best;
+  }
+}
+
+std::uint16_t pack_565_(float const aColor[3]) {
+  auto const r = unsigned(aColor[0] * 31.f / 255.f + 0.5f);
+  auto const g = unsigned(aColor[1] * 63.f / 255.f + 0.5f);
+  auto const b = unsigned(aColor[2] * 31.f / 255.f + 0.5f);
+  return std::uint16_t(r << 11 | g << 5 | b);
+}
+
+std::array<int, 4> unpack_565_(std::uint16_t aColor) {
+  int const r = aColor >> 11 & 31, g = aColor >> 5 & 63, b = aColor & 31;
+  return {r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255};
+}
+
+// BC1 color block in four-color mode (also used as the color part of BC3)
+void encode_color_block_(Block_ const &aBlock, std::uint8_t *aOut) {
+  float lo[4], hi[4];
+  fit_endpoints_(aBlock, 3, lo, hi);
+
+  std::uint16_t c0 = pack_565_(hi), c1 = pack_565_(lo);
+  if (c0 < c1)
+    std::swap(c0, c1);
+
+  std::uint32_t bits = 0;
+  if (c0 != c1) {
+    auto const p0 = unpack_565_(c0), p1 = unpack_565_(c1);
+
+    std::array<std::array<int, 4>, 4> palette{p0, p1, p0, p1};
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (2 * p0[c] + p1[c]) / 3;
+      palette[3][c] = (p0[c] + 2 * p1[c]) / 3;
+    }
+
+    int indices[16];
+    pick_indices_(aBlock, 3, palette, 0, indices);
+    for (int i = 0; i < 16; ++i)
+      bits |= std::uint32_t(indices[i]) << (2 * i);
+  }
+
+  aOut[0] = std::uint8_t(c0);
+  aOut[1] = std::uint8_t(c0 >> 8);
+  aOut[2] = std::uint8_t(c1);
+  aOut[3] = std::uint8_t(c1 >> 8);
+  for (int i = 0; i < 4; ++i)
+    aOut[4 + i] = std::uint8_t(bits >> (8 * i));
+}
+
+void encode_bc1_(Block_ const &aBlock, std::uint8_t *aOut) {
+  encode_color_block_(aBlock, aOut);
+}
+
+void encode_bc3_(Block_ const &aBlock, std::uint8_t *aOut) {
+  // Alpha block in eight-alpha mode (a0 > a1)
+  int a0 = 0, a1 = 255;
+  for (auto const &px : aBlock) {
+    a0 = std::max(a0, int(px[3]));
+    a1 = std::min(a1, int(px[3]));
+  }
+
+  std::uint64_t bits = 0;
+  if (a0 != a1) {
+    std::array<std::array<int, 4>, 8> palette{};
+    palette[0][3] = a0;
+    palette[1][3] = a1;
+    for (int i = 1; i < 7; ++i)
+      palette[i + 1][3] = ((7 - i) * a0 + i * a1) / 7;
+
+    int indices[16];
+    pick_indices_(aBlock, 1, palette, 3, indices);
+    for (int i = 0; i < 16; ++i)
+      bits |= std::uint64_t(indices[i]) << (3 * i);
+  }
+
+  aOut[0] = std::uint8_t(a0);
+  aOut[1] = std::uint8_t(a1);
+  for (int i = 0; i < 6; ++i)
+    aOut[2 + i] = std::uint8_t(bits >> (8 * i));
+
+  encode_color_block_(aBlock, aOut + 8);
+}
+
+// Writes a 128-bit block, least significant bit first
+class BitWriter_ {
+public:
+  explicit BitWriter_(std::uint8_t *aOut) : mOut(aOut) {
+    std::memset(mOut, 0, 16);
+  }
+
+  void put(unsigned aValue, int aBits) {
+    for (int i = 0; i < aBits; ++i, ++mPos)
+      mOut[mPos / 8] |= std::uint8_t((aValue >> i & 1) << (mPos % 8));
+  }
+
+private:
+  std::uint8_t *mOut;
+  int mPos = 0;
+};
+
+// BC7 mode 6: a single subset, RGBA endpoints with 7 bits per channel plus a
+// shared LSB (p-bit) per endpoint, and 4-bit indices.
+void encode_bc7_(Block_ const &aBlock, std::uint8_t *aOut) {
+  static constexpr int kWeights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                       34, 38, 43, 47, 51, 55, 60, 64};
+
+  float ends[2][4];
+  fit_endpoints_(aBlock, 4, ends[0], ends[1]);
+
+  // Opaque blocks must decode to an alpha of exactly 255, which requires a
+  // p-bit of one
+  bool opaque = true;
+  for (auto const &px : aBlock)
+    opaque = opaque && 255 == px[3];
+
+  // Quantize each endpoint, picking the p-bit with the lower error
+  unsigned q[2][4], p[2];
+  std::array<int, 4> e[2];
+  for (int k = 0; k < 2; ++k) {
+    float bestErr = 1e30f;
+    for (unsigned pbit = opaque ? 1 : 0; pbit < 2; ++pbit) {
+      unsigned cand[4];
+      float err = 0.f;
+      for (int c = 0; c < 4; ++c) {
+        float const v = (ends[k][c] - float(pbit)) * 0.5f;
+        cand[c] = unsigned(std::clamp(v + 0.5f, 0.f, 127.f));
+        float const d = float(cand[c] * 2 + pbit) - ends[k][c];
+        err += d * d;
+      }
+      if (err < bestErr) {
+        bestErr = err;
+        p[k] = pbit;
+        std::copy(cand, cand + 4, q[k]);
+      }
+    }
+
+    for (int c = 0; c < 4; ++c)
+      e[k][c] = int(q[k][c] << 1 | p[k]);
+  }
+
+  std::array<std::array<int, 4>, 16> palette;
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 4; ++c)
+      palette[i][c] =
+          ((64 - kWeights[i]) * e[0][c] + kWeights[i] * e[1][c] + 32) >> 6;
+
+  int indices[16];
+  pick_indices_(aBlock, 4, palette, 0, indices);
+
+  // The MSB of the first index is implicitly zero; swap the endpoints if
+  // necessary.
+  if (indices[0] & 8) {
+    std::swap(q[0], q[1]);
+    std::swap(p[0], p[1]);
+    for (int &idx : indices)
+      idx = 15 - idx;
+  }
+
+  BitWriter_ out(aOut);
+  out.put(1u << 6, 7); // mode 6
+
+  for (int c = 0; c < 4; ++c) {
+    out.put(q[0][c], 7);
+    out.put(q[1][c], 7);
+  }
+
+  out.put(p[0], 1);
+  out.put(p[1], 1);
+
+  out.put(unsigned(indices[0]), 3);
+  for (int i = 1; i < 16; ++i)
+    out.put(unsigned(indices[i]), 4);
+}
+
+bool format_supported_(std::uint32_t aFormat, CompressedFormatSupport aSupport) {
+  switch (aFormat) {
+  case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+    return aSupport.s3tc;
+  case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+    return aSupport.bptc;
+  }
+  return false;
+}
+
+std::string cache_path_(char const *aPath) {
+  auto const &dir = texture_cache_dir_();
+  if (dir.empty())
+    return {};
+
+  // 64-bit FNV-1a over the source path
+  std::uint64_t hash = 14695981039346656037ull;
+  for (char const *ch = aPath; *ch; ++ch) {
+    hash ^= std::uint8_t(*ch);
+    hash *= 1099511628211ull;
+  }
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.ctex",
+                static_cast<unsigned long long>(hash));
+
+  return (std::filesystem::path(dir) / name).string();
+}
+
+bool read_cached_(std::string const &aCachePath, CtexHeader_ const &aExpected,
+                  CompressedFormatSupport aSupport, CompressedImage &aOut) {
+  std::FILE *fin = std::fopen(aCachePath.c_str(), "rb");
+  if (!fin)
+    return false;
+
+  CtexHeader_ header{};
+  bool ok = 1 == std::fread(&header, sizeof(header), 1, fin) &&
+            0 == std::memcmp(header.magic, aExpected.magic,
+                             sizeof(header.magic)) &&
+            header.version == aExpected.version &&
+            header.sourceSize == aExpected.sourceSize &&
+            header.sourceTime == aExpected.sourceTime &&
+            format_supported_(header.format, aSupport) &&
+            header.width > 0 && header.height > 0 && header.levelCount > 0;
+
+  CompressedImage ret;
+  ret.format = header.format;
+  ret.width = int(header.width);
+  ret.height = int(header.height);
+
+  int w = ret.width, h = ret.height;
+  for (std::uint32_t l = 0; ok && l < header.levelCount; ++l) {
+    std::uint32_t size = 0;
+    ok = 1 == std::fread(&size, sizeof(size), 1, fin);
+
+    if (ok) {
+      ret.levels.push_back({w, h, ret.data.size(), size});
+      ret.data.resize(ret.data.size() + size);
+      ok = size == std::fread(ret.data.data() + ret.levels.back().offset, 1,
+                              size, fin);
+    }
+
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+
+  std::fclose(fin);
+
+  if (ok)
+    aOut = std::move(ret);
+
+  return ok;
+}
+
+void write_cached_(std::string const &aCachePath, CtexHeader_ const &aStamp,
+                   CompressedImage const &aImage) {
+  CtexHeader_ header = aStamp;
+  header.format = aImage.format;
+  header.width = std::uint32_t(aImage.width);
+  header.height = std::uint32_t(aImage.height);
+  header.levelCount = std::uint32_t(aImage.levels.size());
+
+  // The cache is an optimization only; report problems and carry on.
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(aCachePath).parent_path(), ec);
+
+  // Write to a temporary file first and rename it into place, so that a
+  // concurrent reader never sees a partial file.
+  auto const tempPath = aCachePath + ".tmp";
+
+  std::FILE *fout = std::fopen(tempPath.c_str(), "wb");
+  if (!fout) {
+    std::fprintf(stderr, "Note: unable to write texture cache '%s'\n",
+                 tempPath.c_str());
+    return;
+  }
+
+  bool ok = 1 == std::fwrite(&header, sizeof(header), 1, fout);
+  for (auto const &level : aImage.levels) {
+    auto const size = std::uint32_t(level.size);
+    ok = ok && 1 == std::fwrite(&size, sizeof(size), 1, fout);
+    ok = ok && level.size == std::fwrite(aImage.data.data() + level.offset, 1,
+                                         level.size, fout);
+  }
+
+  if (0 != std::fclose(fout))
+    ok = false;
+
+  if (ok)
+    std::filesystem::rename(tempPath, aCachePath, ec);
+
+  if (!ok || ec) {
+    std::fprintf(stderr, "Note: unable to write texture cache '%s'\n",
+                 aCachePath.c_str());
+    std::filesystem::remove(tempPath, ec);
+  }
+}
+} // namespace
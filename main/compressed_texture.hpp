@@ -0,0 +1,66 @@
+#ifndef COMPRESSED_TEXTURE_HPP_3C9B1E57_0D2A_4F86_B4E1_7A5F2C8D9E60
+#define COMPRESSED_TEXTURE_HPP_3C9B1E57_0D2A_4F86_B4E1_7A5F2C8D9E60
+
+#include <glad.h>
+
+#include <vector>
+
+#include <cstddef>
+
+// The S3TC formats are not part of core OpenGL, and the glad loader does not
+// define them.
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#	define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#	define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+struct ImageRGBA8;
+
+// Block-compressed formats that can be used for textures
+struct CompressedFormatSupport
+{
+	bool s3tc = false; // BC1 and BC3 (sRGB)
+	bool bptc = false; // BC7 (sRGB)
+};
+
+// Block-compressed image with a full mip chain. The level data is ready to
+// be passed to glCompressedTexImage2D().
+struct CompressedImage
+{
+	struct Level
+	{
+		int width, height;
+		std::size_t offset, size; // into data
+	};
+
+	GLenum format = 0; // compressed sRGB internal format
+	int width = 0, height = 0;
+
+	std::vector<Level> levels;
+	std::vector<unsigned char> data;
+};
+
+/* Compress an image into one of the supported formats:
+ *
+ *  - opaque images use BC1 (4 bits/pixel), or BC7 without S3TC support
+ *  - images with alpha use BC7 (8 bits/pixel), or BC3 without BPTC support
+ *
+ * The mip levels are downsampled in linear space before compressing them.
+ * Throws an Error if neither format is supported. Does not use OpenGL.
+ */
+CompressedImage compress_image( ImageRGBA8 const&, CompressedFormatSupport );
+
+// Load the image at aPath as a compressed image. If a texture cache is set
+// (see set_texture_cache()), the compressed result is stored there and
+// reused as long as the source file is unchanged and its format is still
+// supported. Thread-safe; does not use OpenGL.
+CompressedImage load_compressed_image( char const* aPath, CompressedFormatSupport );
+
+// Enable the on-disk cache of compressed textures in the given directory.
+// Pass nullptr to disable the cache (default). Not thread-safe; call before
+// loading any textures.
+void set_texture_cache( char const* aDirectory );
+
+#endif // COMPRESSED_TEXTURE_HPP_3C9B1E57_0D2A_4F86_B4E1_7A5F2C8D9E60
@@ -0,0 +1,60 @@
+#include "fast_random.hpp"
+
+#include <algorithm>
+
+namespace {
+std::uint64_t splitmix64_(std::uint64_t &aState) noexcept {
+  std::uint64_t z = (aState += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+} // namespace
+
+FastRandom::FastRandom(std::uint64_t aSeed) noexcept { seed(aSeed); }
+
+void FastRandom::seed(std::uint64_t aSeed) noexcept {
+  std::uint64_t sm = aSeed;
+  for (std::size_t lane = 0; lane < kLanes; ++lane) {
+    std::uint64_t const a = splitmix64_(sm), b = splitmix64_(sm);
+    mState[0][lane] = std::uint32_t(a);
+    mState[1][lane] = std::uint32_t(a >> 32);
+    mState[2][lane] = std::uint32_t(b);
+    mState[3][lane] = std::uint32_t(b >> 32);
+  }
+}
+
+void FastRandom::fill_unit(float *aOut, std::size_t aCount) noexcept {
+  // Work on a local copy of the state, which the compiler knows is not
+  // aliased by aOut, so that the lane loop vectorizes
+  std::uint32_t s0[kLanes], s1[kLanes], s2[kLanes], s3[kLanes];
+  std::copy(mState[0], mState[0] + kLanes, s0);
+  std::copy(mState[1], mState[1] + kLanes, s1);
+  std::copy(mState[2], mState[2] + kLanes, s2);
+  std::copy(mState[3], mState[3] + kLanes, s3);
+
+  float block[kLanes];
+  for (std::size_t i = 0; i < aCount; i += kLanes) {
+    for (std::size_t lane = 0; lane < kLanes; ++lane) {
+      std::uint32_t const result = s0[lane] + s3[lane];
+      std::uint32_t const t = s1[lane] << 9;
+
+      s2[lane] ^= s0[lane];
+      s3[lane] ^= s1[lane];
+      s1[lane] ^= s2[lane];
+      s0[lane] ^= s3[lane];
+      s2[lane] ^= t;
+      s3[lane] = (s3[lane] << 11) | (s3[lane] >> 21);
+
+      // The upper 24 bits fill a float's mantissa exactly
+      block[lane] = float(result >> 8) * (1.f / 16777216.f);
+    }
+
+    std::copy(block, block + std::min(kLanes, aCount - i), aOut + i);
+  }
+
+  std::copy(s0, s0 + kLanes, mState[0]);
+  std::copy(s1, s1 + kLanes, mState[1]);
+  std::copy(s2, s2 + kLanes, mState[2]);
+  std::copy(s3, s3 + kLanes, mState[3]);
+}
@@ -0,0 +1,36 @@
+#ifndef FAST_RANDOM_HPP_8C3F0B6E_27D1_4A95_B4E8_1D6A9F2C7E53
+#define FAST_RANDOM_HPP_8C3F0B6E_27D1_4A95_B4E8_1D6A9F2C7E53
+
+#include <cstddef>
+#include <cstdint>
+
+/* Bulk random number generation
+ *
+ * xoshiro128+ (Blackman & Vigna), run as kLanes independent generators. The
+ * states are stored lane by lane, so that the compiler can advance all lanes
+ * with a handful of SIMD instructions, producing kLanes numbers at a time.
+ * The lanes are seeded from a single 64-bit seed with splitmix64, so equal
+ * seeds give equal sequences.
+ *
+ * xoshiro128+ is meant for floating point numbers: the low bits of its
+ * output are weak, and are discarded when converting to float.
+ */
+class FastRandom final
+{
+	public:
+		static constexpr std::size_t kLanes = 8;
+
+	public:
+		explicit FastRandom( std::uint64_t aSeed = 0 ) noexcept;
+
+	public:
+		void seed( std::uint64_t ) noexcept;
+
+		// Uniformly distributed in [0, 1)
+		void fill_unit( float* aOut, std::size_t aCount ) noexcept;
+
+	private:
+		alignas(32) std::uint32_t mState[4][kLanes];
+};
+
+#endif // FAST_RANDOM_HPP_8C3F0B6E_27D1_4A95_B4E8_1D6A9F2C7E53
@@ -1,10 +1,99 @@
 #include "loadobj.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
 #include <rapidobj/rapidobj.hpp>
 
 #include "../support/error.hpp"
 
-SimpleMeshData load_wavefront_obj(char const *aPath) {
+namespace {
+// An output vertex is identified by the OBJ attribute indices it was built
+// from, plus the material (which provides the vertex color).
+struct VertexKey_ {
+  int position, normal, texcoord, material;
+
+  bool operator==(VertexKey_ const &aOther) const noexcept {
+    return position == aOther.position && normal == aOther.normal &&
+           texcoord == aOther.texcoord && material == aOther.material;
+  }
+};
+
+struct VertexKeyHash_ {
+  std::size_t operator()(VertexKey_ const &aKey) const noexcept {
+    std::size_t h = std::size_t(aKey.position) * 73856093u;
+    h ^= std::size_t(aKey.normal) * 19349663u;
+    h ^= std::size_t(aKey.texcoord) * 83492791u;
+    h ^= std::size_t(aKey.material) * 2654435761u;
+    return h;
+  }
+};
+
+// Indices converted per task. Large enough to amortise the per-chunk hash
+// map, small enough to balance the load.
+constexpr std::size_t kChunkIndices_ = 64 * 1024;
+
+// Part of the index stream, converted independently
+struct Chunk_ {
+  std::vector<VertexKey_> keys;       // unique vertices, in order of first use
+  std::vector<std::uint32_t> indices; // into keys
+
+  std::vector<std::uint32_t> remap; // keys to output vertices
+  std::vector<bool> introduces;     // first use of the vertex in the mesh
+};
+
+// Call aTask(i) for each i < aCount, on up to aMaxThreads threads
+template <typename tTask>
+void parallel_for_(std::size_t aCount, std::size_t aMaxThreads,
+                   tTask const &aTask) {
+  std::size_t const threadCount = std::min(aCount, aMaxThreads);
+
+  if (threadCount <= 1) {
+    for (std::size_t i = 0; i < aCount; ++i)
+      aTask(i);
+    return;
+  }
+
+  std::atomic<std::size_t> next{0};
+  std::vector<std::exception_ptr> errors(threadCount);
+
+  auto run = [&](std::size_t aThread) {
+    try {
+      for (std::size_t i; (i = next++) < aCount;)
+        aTask(i);
+    } catch (...) {
+      errors[aThread] = std::current_exception();
+      next = aCount;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < threadCount; ++t)
+    threads.emplace_back(run, t);
+
+  run(0);
+
+  for (auto &thread : threads)
+    thread.join();
+
+  for (auto const &error : errors) {
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
+} // namespace
+
+SimpleMeshData load_wavefront_obj(char const *aPath, std::size_t aMaxThreads) {
+  std::size_t const maxThreads =
+      aMaxThreads ? aMaxThreads
+                  : std::max(1u, std::thread::hardware_concurrency());
+
   // Ask rapidobj to load the requested file
   auto result = rapidobj::ParseFile(aPath);
 
@@ -19,39 +108,135 @@ SimpleMeshData load_wavefront_obj(char const *aPath) {
   // Fortunately, rapidobj can do this for us.
   rapidobj::Triangulate(result);
 
-  // Convert the OBJ data into a SimpleMeshData structure.
-  // For now, we simply turn the object into a triangle soup,
-  // ignoring the indexing information that the OBJ file contains.
-  SimpleMeshData ret;
-
+  // Convert the OBJ data into an indexed SimpleMeshData structure.
+  // OBJ indexes each attribute separately, whereas OpenGL uses a single index
+  // per vertex. Each unique combination of attribute indices (and material)
+  // therefore becomes one output vertex, which is shared by all triangles
+  // that reference it.
+  //
+  // The conversion runs in three steps. First, chunks of the index stream
+  // find their unique vertices in parallel. Then, the chunks' vertices are
+  // numbered in order, which gives the same numbering as a serial pass.
+  // Finally, the chunks fill their (disjoint) parts of the presized output
+  // in parallel.
+  std::vector<std::size_t> shapeStart; // index stream offset, per shape
+  std::size_t indexCount = 0;
   for (auto const &shape : result.shapes) {
-    for (std::size_t i = 0; i < shape.mesh.indices.size(); ++i) {
-      auto const &idx = shape.mesh.indices[i];
-
-      ret.positions.emplace_back(
-          Vec3f{result.attributes.positions[idx.position_index * 3 + 0],
-                result.attributes.positions[idx.position_index * 3 + 1],
-                result.attributes.positions[idx.position_index * 3 + 2]});
-
-      // Always triangles, so we can find the face index by dividing the vertex
-      // index by three
-      auto const &mat = result.materials[shape.mesh.material_ids[i / 3]];
-      // ... (add any additional processing as needed)
-
-      // Just replicate the material ambient color for each vertex...
-      ret.colors.emplace_back(
-          Vec3f{mat.ambient[0], mat.ambient[1], mat.ambient[2]});
-
-      ret.normals.emplace_back(
-          Vec3f{result.attributes.normals[idx.normal_index * 3 + 0],
-                result.attributes.normals[idx.normal_index * 3 + 1],
-                result.attributes.normals[idx.normal_index * 3 + 2]});
-      // Rest of the existing code...
-
-      ret.texcoords.emplace_back(
-          Vec2f{result.attributes.texcoords[idx.texcoord_index * 2 + 0],
-                result.attributes.texcoords[idx.texcoord_index * 2 + 1]});
+    shapeStart.push_back(indexCount);
+    indexCount += shape.mesh.indices.size();
+  }
+
+  // Vertex colors replicate the material's ambient color
+  std::vector<Vec3f> materialColors;
+  materialColors.reserve(result.materials.size());
+  for (auto const &mat : result.materials)
+    materialColors.push_back(Vec3f{mat.ambient[0], mat.ambient[1], mat.ambient[2]});
+
+  std::size_t const chunkCount =
+      (indexCount + kChunkIndices_ - 1) / kChunkIndices_;
+  std::vector<Chunk_> chunks(chunkCount);
+
+  parallel_for_(chunkCount, maxThreads, [&](std::size_t aChunk) {
+    auto &chunk = chunks[aChunk];
+
+    std::size_t const begin = aChunk * kChunkIndices_;
+    std::size_t const end = std::min(begin + kChunkIndices_, indexCount);
+
+    chunk.indices.reserve(end - begin);
+
+    std::unordered_map<VertexKey_, std::uint32_t, VertexKeyHash_> local;
+    local.reserve(end - begin);
+
+    // Chunks may span several shapes
+    std::size_t s = std::size_t(
+        std::upper_bound(shapeStart.begin(), shapeStart.end(), begin) -
+        shapeStart.begin() - 1);
+
+    for (std::size_t g = begin; g < end; ++g) {
+      while (g - shapeStart[s] >= result.shapes[s].mesh.indices.size())
+        ++s;
+
+      auto const &mesh = result.shapes[s].mesh;
+      std::size_t const i = g - shapeStart[s];
+      auto const &idx = mesh.indices[i];
+
+      // Always triangles, so we can find the face index by dividing the
+      // vertex index by three
+      VertexKey_ const key{idx.position_index, idx.normal_index,
+                           idx.texcoord_index, mesh.material_ids[i / 3]};
+
+      auto const [it, inserted] =
+          local.try_emplace(key, std::uint32_t(chunk.keys.size()));
+      if (inserted)
+        chunk.keys.push_back(key);
+
+      chunk.indices.push_back(it->second);
+    }
+  });
+
+  // Number the vertices, in order of their first use
+  std::unordered_map<VertexKey_, std::uint32_t, VertexKeyHash_> vertexIds;
+  vertexIds.reserve(indexCount / 2);
+
+  for (auto &chunk : chunks) {
+    chunk.remap.resize(chunk.keys.size());
+    for (std::size_t k = 0; k < chunk.keys.size(); ++k) {
+      auto const [it, inserted] = vertexIds.try_emplace(
+          chunk.keys[k], std::uint32_t(vertexIds.size()));
+      chunk.remap[k] = it->second;
+      chunk.introduces.push_back(inserted);
     }
   }
+
+  SimpleMeshData ret;
+
+  std::size_t const vertexCount = vertexIds.size();
+  ret.positions.resize(vertexCount);
+  ret.colors.resize(vertexCount);
+  ret.normals.resize(vertexCount);
+  ret.texcoords.resize(vertexCount);
+  ret.indices.resize(indexCount);
+
+  parallel_for_(chunkCount, maxThreads, [&](std::size_t aChunk) {
+    auto const &chunk = chunks[aChunk];
+    auto const &attribs = result.attributes;
+
+    std::uint32_t *const out = ret.indices.data() + aChunk * kChunkIndices_;
+    for (std::size_t i = 0; i < chunk.indices.size(); ++i)
+      out[i] = chunk.remap[chunk.indices[i]];
+
+    // Each vertex is written by the chunk that uses it first
+    for (std::size_t k = 0; k < chunk.keys.size(); ++k) {
+      if (!chunk.introduces[k])
+        continue;
+
+      auto const &key = chunk.keys[k];
+      std::uint32_t const v = chunk.remap[k];
+
+      ret.positions[v] = Vec3f{attribs.positions[key.position * 3 + 0],
+                               attribs.positions[key.position * 3 + 1],
+                               attribs.positions[key.position * 3 + 2]};
+
+      ret.colors[v] = key.material >= 0 ? materialColors[key.material]
+                                        : Vec3f{1.f, 1.f, 1.f};
+
+      // Normals and texture coordinates are optional in OBJ files
+      if (key.normal >= 0) {
+        ret.normals[v] = Vec3f{attribs.normals[key.normal * 3 + 0],
+                               attribs.normals[key.normal * 3 + 1],
+                               attribs.normals[key.normal * 3 + 2]};
+      } else {
+        ret.normals[v] = Vec3f{0.f, 0.f, 0.f};
+      }
+
+      if (key.texcoord >= 0) {
+        ret.texcoords[v] = Vec2f{attribs.texcoords[key.texcoord * 2 + 0],
+                                 attribs.texcoords[key.texcoord * 2 + 1]};
+      } else {
+        ret.texcoords[v] = Vec2f{0.f, 0.f};
+      }
+    }
+  });
+
   return ret;
 }
@@ -1,8 +1,13 @@
 #ifndef LOADOBJ_HPP_2CF735BE_6624_413E_B6DC_B5BBA337F96F
 #define LOADOBJ_HPP_2CF735BE_6624_413E_B6DC_B5BBA337F96F
 
+#include <cstddef>
+
 #include "simple_mesh.hpp"
 
-SimpleMeshData load_wavefront_obj( char const* aPath );
+// The conversion to indexed vertices is split among up to aMaxThreads
+// threads; 0 uses all hardware threads. Callers that load several files
+// concurrently should divide the cores among them.
+SimpleMeshData load_wavefront_obj( char const* aPath, std::size_t aMaxThreads = 0 );
 
 #endif // LOADOBJ_HPP_2CF735BE_6624_413E_B6DC_B5BBA337F96F
@@ -4,17 +4,23 @@
 #include <GLFW/glfw3.h>
 // clang-format on
 
-#include "loadobj.hpp"
+#include "asset_loader.hpp"
+#include "mesh_lod.hpp"
+#include "resource_cache.hpp"
 #include "shapes.hpp"
 
 #include "../vmlib/mat33.hpp"
 #include "../vmlib/mat44.hpp"
 #include "../vmlib/vec4.hpp"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 #include <stdexcept>
 #include <typeinfo>
 
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
@@ -33,18 +39,63 @@
 #include "spaceship.hpp"
 #include "texture.hpp"
 
-#include "particle_system.hpp"
+#include "particle_manager.hpp"
+#include "particle_offscreen.hpp"
+#include "particle_oit.hpp"
 
 // Vectors to hold render times for benchmarking
 std::vector<double> fullRenderTime;
 std::vector<double> customRenderTime;
 std::vector<double> otherRenderTime;
+std::vector<double> particleRenderTime;
+std::vector<double> particleOffscreenTime;
 
 namespace {
 constexpr char const *kWindowTitle = "COMP3811 - CW2";
 
 constexpr float kPi_ = 3.1415926f;
 
+// Vertex layout of the scene meshes. The draw time of the scene meshes is
+// recorded in oTime.csv, so switching this to VertexLayout::separate allows
+// the two layouts to be compared. The .smesh files must be baked with the
+// same layout (loadobj --interleaved) to be uploaded without a copy.
+constexpr VertexLayout kSceneMeshLayout_ = VertexLayout::interleaved;
+
+// Bytes of texture data uploaded per frame by streamed textures. The coarse
+// mip levels are resident immediately; a 4k BC1 texture is complete after
+// about three frames.
+constexpr std::size_t kTextureStreamBudget_ = 4 * 1024 * 1024;
+
+// Projected error, in pixels, below which a scene mesh is drawn with a
+// coarser level of detail (see select_lod()).
+constexpr float kLodPixelError_ = 1.f;
+
+// Where the engine's particles are simulated. The exhaust is blended, so
+// it is simulated with compute shaders (ParticleSimulation::gpu), which
+// can depth sort it. ParticleSimulation::analytic avoids the per-frame
+// update, but draws in spawn order.
+constexpr ParticleSimulation kParticleSimulation_ = ParticleSimulation::gpu;
+
+// How the particles are composited. The exhaust is sparse enough to be
+// sorted; ParticleBlend::weightedOit avoids the sort for dense effects.
+constexpr ParticleBlend kParticleBlend_ = ParticleBlend::alpha;
+
+// Resolution of the exhaust's particles, when alpha blended.
+// ParticleResolution::half or quarter draws them off screen, which saves
+// fill rate when the exhaust covers much of the screen. The particle pass,
+// including the update, is timed in particleTime.csv, and the off-screen
+// passes alone in particleOffscreenTime.csv.
+constexpr ParticleResolution kParticleResolution_ = ParticleResolution::full;
+
+// Bound on the estimated cost of all particle effects together, in pixels
+// shaded per frame (see ParticleBudget); a 1080p frame has about 2M pixels.
+// The number of particles is bounded by the pool size.
+constexpr float kParticleMaxCost_ = 4e6f;
+
+// Radius on screen, in pixels, below which the exhaust spawns fewer, larger
+// particles
+constexpr float kExhaustLodPixels_ = 24.f;
+
 constexpr float kMovementPerSecond_ = 5.f;  // units per second
 constexpr float kMouseSensitivity_ = 0.01f; // radians per pixel
 
@@ -96,6 +147,57 @@ struct GLFWWindowDeleter {
   ~GLFWWindowDeleter();
   GLFWwindow *window;
 };
+struct ProgramRegistryCleanupHelper {
+  ~ProgramRegistryCleanupHelper();
+};
+
+// Texture of a scene mesh that is still being loaded. Large textures are
+// streamed (see StreamedTexture) if compressed textures are supported; the
+// other member is null.
+struct PendingTexture_ {
+  std::size_t slot; // into textures, once the mesh is ready
+  ResourceCache::TextureHandle texture;
+  ResourceCache::StreamedTextureHandle streamed;
+};
+
+// Scene mesh that is still being loaded by the AssetLoader
+struct PendingMesh_ {
+  ResourceCache::MeshHandle mesh;
+  std::vector<Mat44f> instances;
+  PendingTexture_ texture; // both members null if untextured
+};
+
+// Chunk of a scene mesh (see MeshChunk), with its bounds for each of the
+// mesh's instances
+struct SceneChunk_ {
+  std::vector<MeshLod> lods;
+  std::vector<BoundingSphere> instanceBounds;
+};
+
+PendingTexture_ request_streamed_texture_(AssetLoader &, ResourceCache &,
+                                          char const *aPath);
+
+std::vector<SceneChunk_> scene_chunks_(SimpleMeshBuffers const &,
+                                       std::vector<Mat44f> const &aInstances);
+
+std::vector<BoundingSphere>
+instance_bounds_(BoundingSphere const &,
+                 std::vector<Mat44f> const &aInstances);
+
+// Level of detail for all instances of a mesh chunk, chosen from the
+// instance that is nearest to the camera. aPixelScale as for select_lod().
+MeshLod const &scene_lod_(std::vector<MeshLod> const &,
+                          std::vector<BoundingSphere> const &aInstanceBounds,
+                          Mat44f const &aWorld2Camera, float aPixelScale);
+
+// Draw the particles over the opaque geometry, as set by kParticleBlend_
+// and the emitters' resolutions. aWidth and aHeight are the framebuffer's
+// size. If aOffscreenQueries is not null, timestamps are written to its two
+// queries before and after the off-screen passes.
+void draw_particles_(ParticleManager &, ParticleOit &, ParticleOffscreen &,
+                     Mat44f const &aProjCameraWorld,
+                     Mat44f const &aCameraWorld, GLsizei aWidth,
+                     GLsizei aHeight, GLuint const *aOffscreenQueries);
 } // namespace
 
 int main() try {
@@ -191,63 +293,66 @@ int main() try {
 
   glViewport(0, 0, iwidth, iheight);
 
+  // Ensure that registered shader programs are deleted before the window
+  // (and its GL context) goes away.
+  ProgramRegistryCleanupHelper programCleanupHelper;
+
+  // Keep linked program binaries between runs; avoids recompiling all
+  // shaders at each start-up.
+  set_program_binary_cache("_cache_/programs");
+
+  // Likewise, keep block-compressed textures (with all mip levels) so that
+  // they are compressed only once.
+  set_texture_cache("_cache_/textures");
+
   // Set shader programs
-  ShaderProgram prog({{GL_VERTEX_SHADER, "assets/default.vert"},
-                      {GL_FRAGMENT_SHADER, "assets/default.frag"}});
+  ShaderProgram &prog = get_program({{GL_VERTEX_SHADER, "assets/default.vert"},
+                                     {GL_FRAGMENT_SHADER, "assets/default.frag"}});
 
-  ShaderProgram ui({{GL_VERTEX_SHADER, "assets/2dshader.vert"},
-                      {GL_FRAGMENT_SHADER, "assets/2dshader.frag"}});
+  ShaderProgram &ui = get_program({{GL_VERTEX_SHADER, "assets/2dshader.vert"},
+                                   {GL_FRAGMENT_SHADER, "assets/2dshader.frag"}});
 
   state.prog = &prog;
 
   auto last = Clock::now();
 
   // Load objects to be rendered
+  // Scene meshes and their textures are loaded in the background; they are
+  // added to the lists below once their upload has completed. Each chunk of
+  // a VAO is drawn once, with one model-to-world transform per instance, at
+  // the level of detail picked for the instance nearest to the camera.
+  // Large meshes (the terrain) are split into chunks, so that their distant
+  // parts are drawn coarser than the parts near the camera.
   std::vector<GLuint> vaos, ui_vaos;
-  std::vector<std::size_t> vertexCounts, vertexCountsUI;
+  std::vector<std::size_t> instanceCounts, vertexCountsUI;
+  std::vector<std::vector<SceneChunk_>> meshChunks;
   std::vector<GLuint> textures, ui_texture;
 
-  GLuint tex = load_texture_2d("assets/L4343A-4k.jpeg");
-
-  auto map = load_wavefront_obj("assets/parlahti.obj");
-  GLuint vao = create_vao(map);
-  vaos.push_back(vao);
-  vertexCounts.push_back(map.positions.size());
-  textures.push_back(tex);
+  AssetLoader assetLoader(window);
+  ResourceCache resources(assetLoader);
 
-  // Load in launchpad 1 and transform each vertex to the location we want
-  auto launchhpad = load_wavefront_obj("assets/landingpad.obj");
-  for (auto &p : launchhpad.positions) {
-    Vec4f p4{p.x, p.y, p.z, 1.f};
-    Vec4f t = make_translation(Vec3f{-10.f, -0.97f, 15.f}) * p4;
-    t /= t.w;
+  // Handles of the resources that are in use (see ResourceCache::collect())
+  std::vector<ResourceCache::MeshHandle> meshHandles;
+  std::vector<ResourceCache::TextureHandle> textureHandles;
+  std::vector<ResourceCache::StreamedTextureHandle> streamedHandles;
 
-    Vec3f pTransformed{t.x, t.y, t.z};
-    p = pTransformed;
-  }
+  std::vector<PendingMesh_> pendingMeshes;
+  std::vector<PendingTexture_> pendingTextures;
 
-  // Create VAO
-  vao = create_vao(launchhpad);
-  vaos.push_back(vao);
-  vertexCounts.push_back(launchhpad.positions.size());
-  textures.push_back(0);
-
-  // Load in launchpad 1 and transform each vertex to the location we want
-  launchhpad = load_wavefront_obj("assets/landingpad.obj");
-  for (auto &p : launchhpad.positions) {
-    Vec4f p4{p.x, p.y, p.z, 1.f};
-    Vec4f t = make_translation(Vec3f{-50.f, -0.97f, 20.f}) * p4;
-    t /= t.w;
-
-    Vec3f pTransformed{t.x, t.y, t.z};
-    p = pTransformed;
-  }
+  pendingMeshes.push_back(
+      {resources.mesh("assets/parlahti.smesh", "assets/parlahti.obj",
+                      kSceneMeshLayout_),
+       {kIdentity44f},
+       request_streamed_texture_(assetLoader, resources,
+                                 "assets/L4343A-4k.jpeg")});
 
-  // Create VAO
-  vao = create_vao(launchhpad);
-  vaos.push_back(vao);
-  vertexCounts.push_back(launchhpad.positions.size());
-  textures.push_back(0);
+  // Load the launchpad once and place one instance of it at each location
+  pendingMeshes.push_back(
+      {resources.mesh("assets/landingpad.smesh", "assets/landingpad.obj",
+                      kSceneMeshLayout_),
+       {make_translation(Vec3f{-10.f, -0.97f, 15.f}),
+        make_translation(Vec3f{-50.f, -0.97f, 20.f})},
+       {}});
 
   // Creating spaceship
   Spaceship spaceship(10, kIdentity44f *
@@ -258,10 +363,14 @@ int main() try {
   glBindVertexArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  // Initialise particle and particleSystem
-  ParticleInit particle;
-  ParticleSystem particleSystem;
+  // Initialise the particles. Effects are emitters of the particle manager,
+  // which share its pool and draw call. The exhaust emits at a fixed rate,
+  // whatever the frame rate.
+  ParticleEmitter exhaust;
+  exhaust.Rate = 60.f;
+  exhaust.LodPixels = kExhaustLodPixels_;
 
+  ParticleInit &particle = exhaust.Init;
   particle.ColorBegin = {254.0f / 255.0f, 212.0f / 255.0f, 123.0f / 255.0f,
                          1.0f};
   particle.ColorEnd = {254.0f / 255.0f, 109.0f / 255.0f, 41.0f / 255.0f, 1.0f};
@@ -273,6 +382,19 @@ int main() try {
   particle.Position = {-10.0f, -0.9f, 15.0f};
   particle.PositionVariation = {0.1f, 0.1f, 0.1f};
 
+  ParticleManager particleManager(1000, kParticleSimulation_,
+                                  ParticleOverflow::stealOldest,
+                                  ParticleShape::billboard);
+  particleManager.System().SetBlend(kParticleBlend_);
+  particleManager.SetBudget({1000, kParticleMaxCost_});
+  ParticleEmitterParams exhaustParams;
+  exhaustParams.Resolution = kParticleResolution_;
+  ParticleEmitterId const exhaustId =
+      particleManager.AddEmitter(exhaust, exhaustParams);
+
+  ParticleOit particleOit;
+  ParticleOffscreen particleOffscreen;
+
   std::chrono::steady_clock::time_point prevTime =
       std::chrono::steady_clock::now();
 
@@ -294,8 +416,8 @@ int main() try {
 
 
   // Benchmarking
-  GLuint queries[6];
-  glGenQueries(6, queries);
+  GLuint queries[10];
+  glGenQueries(10, queries);
 
   // Main loop
   while (!glfwWindowShouldClose(window)) {
@@ -312,6 +434,53 @@ int main() try {
     prevTime = currentTime;
     float deltaTimeInSeconds = deltaTime.count();
 
+    // Pick up assets whose upload has completed. Meshes are drawn as soon
+    // as they are ready, even if their texture is still loading.
+    for (auto it = pendingMeshes.begin(); it != pendingMeshes.end();) {
+      if (!it->mesh->ready()) {
+        ++it;
+        continue;
+      }
+
+      GLuint const vao = create_vao(it->mesh->value());
+      create_instance_buffer(vao, it->instances);
+
+      vaos.push_back(vao);
+      meshChunks.push_back(scene_chunks_(it->mesh->value(), it->instances));
+      instanceCounts.push_back(it->instances.size());
+      textures.push_back(0);
+      meshHandles.push_back(it->mesh);
+
+      if (it->texture.texture || it->texture.streamed) {
+        it->texture.slot = textures.size() - 1;
+        pendingTextures.push_back(std::move(it->texture));
+      }
+
+      it = pendingMeshes.erase(it);
+    }
+
+    for (auto it = pendingTextures.begin(); it != pendingTextures.end();) {
+      if (it->texture && it->texture->ready()) {
+        textures[it->slot] = it->texture->value();
+        textureHandles.push_back(it->texture);
+      } else if (it->streamed && it->streamed->ready()) {
+        textures[it->slot] = it->streamed->texture().handle();
+        streamedHandles.push_back(it->streamed);
+      } else {
+        ++it;
+        continue;
+      }
+
+      it = pendingTextures.erase(it);
+    }
+
+    // Drop loaded resources that are no longer referenced (e.g., compressed
+    // images, once their StreamedTexture has been created)
+    resources.collect();
+
+    // Stream in finer mip levels, within a fixed upload budget per frame
+    resources.stream_textures(kTextureStreamBudget_);
+
     auto const now = Clock::now();
     float dt = std::chrono::duration_cast<Secondsf>(now - last).count();
     last = now;
@@ -448,22 +617,6 @@ int main() try {
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // Particle System
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    if (state.animation.animated) {
-      state.animation.time += deltaTimeInSeconds;
-    }
-    if (state.animation.animated) {
-      particleSystem.Update(deltaTimeInSeconds);
-      particleSystem.Spawn(particle);
-      particleSystem.Render(projCameraWorld);
-    }
-
-    glDisable(GL_BLEND);
-    // Particle System end
-
     // Full render time start query
     glQueryCounter(queries[4], GL_TIMESTAMP);
 
@@ -484,11 +637,23 @@ int main() try {
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindVertexArray(0);
 
+    // Pixels per unit of view-space size at unit distance
+    float const lodPixelScale = fbheight / (2.f * std::tan(30.f * kPi_ / 180.f));
+
     for (unsigned int i = 0; i < vaos.size(); i++) {
       glBindVertexArray(vaos[i]);
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, textures[i]);
-      glDrawArrays(GL_TRIANGLES, 0, vertexCounts[i]);
+
+      for (auto const &chunk : meshChunks[i]) {
+        auto const &lod = scene_lod_(chunk.lods, chunk.instanceBounds,
+                                     world2camera, lodPixelScale);
+        glDrawElementsInstanced(
+            GL_TRIANGLES, GLsizei(lod.indexCount), GL_UNSIGNED_INT,
+            reinterpret_cast<void const *>(lod.firstIndex *
+                                           sizeof(std::uint32_t)),
+            GLsizei(instanceCounts[i]));
+      }
     }
     // Other render time end query
     glQueryCounter(queries[5], GL_TIMESTAMP);
@@ -501,8 +666,29 @@ int main() try {
     // Custom model render time end query
     glQueryCounter(queries[3], GL_TIMESTAMP);
 
+    // Particle render time start query
+    glQueryCounter(queries[6], GL_TIMESTAMP);
+
+    // Particle System, after the opaque geometry, which occludes it. The
+    // off-screen passes are timed by queries[8] and [9].
+    bool const particlesDrawn = state.animation.animated;
+    if (particlesDrawn) {
+      state.animation.time += deltaTimeInSeconds;
+      particleManager.Update(deltaTimeInSeconds,
+                             {projCameraWorld, world2camera * model2world,
+                              lodPixelScale});
+      draw_particles_(particleManager, particleOit, particleOffscreen,
+                      projCameraWorld, world2camera * model2world,
+                      GLsizei(fbwidth), GLsizei(fbheight), queries + 8);
+    }
+    // Particle System end
+
+    // Particle render time end query
+    glQueryCounter(queries[7], GL_TIMESTAMP);
+
     spaceship.update(state.animation.time);
-    particle.Position = spaceship.location + spaceship.offset;
+    particleManager.Emitter(exhaustId).Init.Position =
+        spaceship.location + spaceship.offset;
     glUseProgram(prog.programId());
 
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -623,22 +809,6 @@ int main() try {
       // Draw scene
       OGL_CHECKPOINT_DEBUG();
 
-      // Particle System
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-      if (state.animation.animated) {
-        state.animation.time += deltaTimeInSeconds;
-      }
-      if (state.animation.animated) {
-        particleSystem.Update(deltaTimeInSeconds);
-        particleSystem.Spawn(particle);
-        particleSystem.Render(projCameraWorld);
-      }
-
-      glDisable(GL_BLEND);
-      // Particle System end
-
       glUseProgram(prog.programId());
 
       glUniformMatrix4fv(2, 1, GL_TRUE, projCameraWorld.v);
@@ -657,12 +827,35 @@ int main() try {
         glBindVertexArray(vaos[i]);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, textures[i]);
-        glDrawArrays(GL_TRIANGLES, 0, vertexCounts[i]);
+
+        for (auto const &chunk : meshChunks[i]) {
+          auto const &lod = scene_lod_(chunk.lods, chunk.instanceBounds,
+                                       world2camera, lodPixelScale);
+          glDrawElementsInstanced(
+              GL_TRIANGLES, GLsizei(lod.indexCount), GL_UNSIGNED_INT,
+              reinterpret_cast<void const *>(lod.firstIndex *
+                                             sizeof(std::uint32_t)),
+              GLsizei(instanceCounts[i]));
+        }
       }
 
       spaceship.render(projCameraWorld);
+
+      // Particle System
+      if (state.animation.animated) {
+        state.animation.time += deltaTimeInSeconds;
+        particleManager.Update(deltaTimeInSeconds,
+                               {projCameraWorld, world2camera * model2world,
+                                lodPixelScale});
+        draw_particles_(particleManager, particleOit, particleOffscreen,
+                        projCameraWorld, world2camera * model2world,
+                        GLsizei(fbwidth), GLsizei(fbheight), nullptr);
+      }
+      // Particle System end
+
       spaceship.update(state.animation.time);
-      particle.Position = spaceship.location + spaceship.offset;
+      particleManager.Emitter(exhaustId).Init.Position =
+          spaceship.location + spaceship.offset;
 
       glBindTexture(GL_TEXTURE_2D, 0);
       glBindVertexArray(0);
@@ -679,23 +872,35 @@ int main() try {
     // End Screens
 
     // Get timestamp queries for benchmarking
-    GLuint64 fullRenderStartTime, fullRenderEndTime, customRenderStartTime, customRenderEndTime, otherRenderStartTime, otherRenderEndTime;
+    GLuint64 fullRenderStartTime, fullRenderEndTime, customRenderStartTime, customRenderEndTime, otherRenderStartTime, otherRenderEndTime, particleRenderStartTime, particleRenderEndTime;
     glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &fullRenderStartTime);
     glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &fullRenderEndTime);
     glGetQueryObjectui64v(queries[2], GL_QUERY_RESULT, &customRenderStartTime);
     glGetQueryObjectui64v(queries[3], GL_QUERY_RESULT, &customRenderEndTime);
     glGetQueryObjectui64v(queries[4], GL_QUERY_RESULT, &otherRenderStartTime);
     glGetQueryObjectui64v(queries[5], GL_QUERY_RESULT, &otherRenderEndTime);
+    glGetQueryObjectui64v(queries[6], GL_QUERY_RESULT, &particleRenderStartTime);
+    glGetQueryObjectui64v(queries[7], GL_QUERY_RESULT, &particleRenderEndTime);
 
     // Calculate time delta
     double fRenderTime = (fullRenderEndTime - fullRenderStartTime); // time in nanoseconds
     double cRenderTime = (customRenderEndTime - customRenderStartTime);
     double oRenderTime = (otherRenderEndTime - otherRenderStartTime);
+    double pRenderTime = (particleRenderEndTime - particleRenderStartTime);
 
     // Push deltas to respective vectors
     fullRenderTime.push_back(fRenderTime);
     customRenderTime.push_back(cRenderTime);
     otherRenderTime.push_back(oRenderTime);
+    particleRenderTime.push_back(pRenderTime);
+
+    // Only written while the particles are drawn
+    if (particlesDrawn) {
+      GLuint64 offscreenStartTime, offscreenEndTime;
+      glGetQueryObjectui64v(queries[8], GL_QUERY_RESULT, &offscreenStartTime);
+      glGetQueryObjectui64v(queries[9], GL_QUERY_RESULT, &offscreenEndTime);
+      particleOffscreenTime.push_back(double(offscreenEndTime - offscreenStartTime));
+    }
     
     // Display results
     glfwSwapBuffers(window);
@@ -703,6 +908,8 @@ int main() try {
 
   // Cleanup.
   // TODO: additional cleanup
+  std::printf("Scene resources: %zu (%.1f MiB)\n", resources.resources().size(),
+              resources.total_bytes() / (1024.0 * 1024.0));
 
   return 0;
 } catch (std::exception const &eErr) {
@@ -749,6 +956,22 @@ void glfw_callback_key_(GLFWwindow *aWindow, int aKey, int, int aAction, int mod
     }
     myfile.close();
 
+    myfile.open("particleTime.csv");
+    vsize = particleRenderTime.size();
+    for (int n=0; n<vsize; n++)
+    {
+        myfile << particleRenderTime[n] << std::endl;
+    }
+    myfile.close();
+
+    myfile.open("particleOffscreenTime.csv");
+    vsize = particleOffscreenTime.size();
+    for (int n=0; n<vsize; n++)
+    {
+        myfile << particleOffscreenTime[n] << std::endl;
+    }
+    myfile.close();
+
     return;
   }
 
@@ -974,4 +1197,110 @@ GLFWWindowDeleter::~GLFWWindowDeleter() {
   if (window)
     glfwDestroyWindow(window);
 }
+
+ProgramRegistryCleanupHelper::~ProgramRegistryCleanupHelper() {
+  clear_program_registry();
+}
+
+PendingTexture_ request_streamed_texture_(AssetLoader &aLoader,
+                                          ResourceCache &aResources,
+                                          char const *aPath) {
+  PendingTexture_ ret{};
+  if (aLoader.supports_compressed_textures())
+    ret.streamed = aResources.streamed_texture(aPath);
+  else
+    ret.texture = aResources.texture_2d(aPath);
+  return ret;
+}
+
+std::vector<BoundingSphere>
+instance_bounds_(BoundingSphere const &aBounds,
+                 std::vector<Mat44f> const &aInstances) {
+  std::vector<BoundingSphere> ret;
+  ret.reserve(aInstances.size());
+
+  for (auto const &model2world : aInstances) {
+    auto const c = model2world * Vec4f{aBounds.center.x, aBounds.center.y,
+                                       aBounds.center.z, 1.f};
+
+    // Largest scale factor of the instance's transform
+    float scale = 0.f;
+    for (std::size_t j = 0; j < 3; ++j) {
+      scale = std::max(scale, length(Vec3f{model2world(0, j), model2world(1, j),
+                                           model2world(2, j)}));
+    }
+
+    ret.push_back({Vec3f{c.x, c.y, c.z}, aBounds.radius * scale});
+  }
+
+  return ret;
+}
+
+std::vector<SceneChunk_> scene_chunks_(SimpleMeshBuffers const &aMesh,
+                                       std::vector<Mat44f> const &aInstances) {
+  std::vector<SceneChunk_> ret;
+  ret.reserve(aMesh.chunks.size());
+
+  for (auto const &chunk : aMesh.chunks) {
+    auto const lods = aMesh.lods.begin() + chunk.firstLod;
+    ret.push_back({std::vector<MeshLod>(lods, lods + chunk.lodCount),
+                   instance_bounds_(chunk.bounds, aInstances)});
+  }
+
+  return ret;
+}
+
+MeshLod const &scene_lod_(std::vector<MeshLod> const &aLods,
+                          std::vector<BoundingSphere> const &aInstanceBounds,
+                          Mat44f const &aWorld2Camera, float aPixelScale) {
+  auto const cam = invert(aWorld2Camera) * Vec4f{0.f, 0.f, 0.f, 1.f};
+  Vec3f const camPos{cam.x, cam.y, cam.z};
+
+  // Distance to the nearest bounding sphere; zero if the camera is inside
+  // any of them, which selects full detail.
+  float distance = std::numeric_limits<float>::max();
+  for (auto const &bounds : aInstanceBounds) {
+    distance = std::min(distance, std::max(0.f, length(bounds.center - camPos) -
+                                                    bounds.radius));
+  }
+
+  return aLods[select_lod(aLods, distance, aPixelScale, kLodPixelError_)];
+}
+
+void draw_particles_(ParticleManager &aParticles, ParticleOit &aOit,
+                     ParticleOffscreen &aOffscreen,
+                     Mat44f const &aProjCameraWorld,
+                     Mat44f const &aCameraWorld, GLsizei aWidth,
+                     GLsizei aHeight, GLuint const *aOffscreenQueries) {
+  bool const alpha = ParticleBlend::alpha == kParticleBlend_;
+  if (!alpha) {
+    aOit.begin(aWidth, aHeight);
+    aParticles.Render(aProjCameraWorld, aCameraWorld);
+    aOit.end();
+  } else if (aParticles.UsesResolution(ParticleResolution::full)) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    aParticles.Render(aProjCameraWorld, aCameraWorld,
+                      ParticleResolution::full);
+    glDisable(GL_BLEND);
+  }
+
+  // Emitters at a reduced resolution, one off-screen pass per resolution
+  if (aOffscreenQueries)
+    glQueryCounter(aOffscreenQueries[0], GL_TIMESTAMP);
+
+  for (auto const resolution :
+       {ParticleResolution::half, ParticleResolution::quarter}) {
+    if (!alpha || !aParticles.UsesResolution(resolution))
+      continue;
+
+    aOffscreen.begin(resolution);
+    aParticles.Render(aProjCameraWorld, aCameraWorld, resolution);
+    aOffscreen.end();
+  }
+
+  if (aOffscreenQueries)
+    glQueryCounter(aOffscreenQueries[1], GL_TIMESTAMP);
+}
+
 } // namespace
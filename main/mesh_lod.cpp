@@ -0,0 +1,499 @@
+#include "mesh_lod.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include <cassert>
+#include <cmath>
+
+namespace {
+// Symmetric 4x4 error quadric; the upper triangle is stored row by row.
+// Planes are weighted by the area of their triangle.
+struct Quadric_ {
+  double a[10] = {};
+  double weight = 0.0;
+
+  void add_plane(double aNx, double aNy, double aNz, double aD,
+                 double aWeight) {
+    double const p[4] = {aNx, aNy, aNz, aD};
+    int k = 0;
+    for (int i = 0; i < 4; ++i)
+      for (int j = i; j < 4; ++j)
+        a[k++] += aWeight * p[i] * p[j];
+    weight += aWeight;
+  }
+
+  Quadric_ &operator+=(Quadric_ const &aOther) {
+    for (int i = 0; i < 10; ++i)
+      a[i] += aOther.a[i];
+    weight += aOther.weight;
+    return *this;
+  }
+
+  // Weighted mean of the squared distances of the point to the planes
+  double eval(Vec3f aPos) const {
+    double const x = aPos.x, y = aPos.y, z = aPos.z;
+    double const sum = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z +
+                       2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z +
+                       2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+  }
+};
+
+Vec3f cross_(Vec3f aLeft, Vec3f aRight) {
+  return {aLeft.y * aRight.z - aLeft.z * aRight.y,
+          aLeft.z * aRight.x - aLeft.x * aRight.z,
+          aLeft.x * aRight.y - aLeft.y * aRight.x};
+}
+
+// Simplification state that persists across the levels of a chain. Vertices
+// with equal positions form one group; collapses operate on groups.
+struct Simplifier_ {
+  SimpleMeshData const &mesh;
+
+  std::vector<std::uint32_t> groupOf; // per vertex
+  std::vector<Vec3f> groupPos;
+  std::vector<std::vector<std::uint32_t>> groupVertices;
+  std::vector<Quadric_> quadrics; // per group
+
+  explicit Simplifier_(SimpleMeshData const &aMesh);
+
+  // Collapse edges until at most aTargetIndexCount indices remain, or no
+  // further collapse is possible. Returns the largest error introduced.
+  float simplify(std::vector<std::uint32_t> &aIndices,
+                 std::size_t aTargetIndexCount);
+
+private:
+  bool simplify_pass_(std::vector<std::uint32_t> &aIndices,
+                      std::size_t aTargetIndexCount, double &aMaxCost);
+};
+
+struct PositionKey_ {
+  std::uint32_t bits[3];
+
+  bool operator==(PositionKey_ const &aOther) const noexcept {
+    return 0 == std::memcmp(bits, aOther.bits, sizeof(bits));
+  }
+};
+
+struct PositionKeyHash_ {
+  std::size_t operator()(PositionKey_ const &aKey) const noexcept {
+    return std::size_t(aKey.bits[0]) * 73856093u ^
+           std::size_t(aKey.bits[1]) * 19349663u ^
+           std::size_t(aKey.bits[2]) * 83492791u;
+  }
+};
+
+Simplifier_::Simplifier_(SimpleMeshData const &aMesh) : mesh(aMesh) {
+  std::unordered_map<PositionKey_, std::uint32_t, PositionKeyHash_> groups;
+  groups.reserve(aMesh.positions.size());
+
+  groupOf.resize(aMesh.positions.size());
+  for (std::size_t v = 0; v < aMesh.positions.size(); ++v) {
+    PositionKey_ key;
+    std::memcpy(key.bits, &aMesh.positions[v], sizeof(key.bits));
+
+    auto const [it, inserted] =
+        groups.try_emplace(key, std::uint32_t(groupPos.size()));
+    if (inserted) {
+      groupPos.emplace_back(aMesh.positions[v]);
+      groupVertices.emplace_back();
+    }
+
+    groupOf[v] = it->second;
+    groupVertices[it->second].push_back(std::uint32_t(v));
+  }
+
+  // Each group starts out with the planes of its adjacent triangles
+  quadrics.resize(groupPos.size());
+  for (std::size_t i = 0; i + 2 < aMesh.indices.size(); i += 3) {
+    std::uint32_t const g[3] = {groupOf[aMesh.indices[i + 0]],
+                                groupOf[aMesh.indices[i + 1]],
+                                groupOf[aMesh.indices[i + 2]]};
+
+    Vec3f const n =
+        cross_(groupPos[g[1]] - groupPos[g[0]], groupPos[g[2]] - groupPos[g[0]]);
+    float const len = length(n);
+    if (len <= 0.f)
+      continue;
+
+    Vec3f const un = n / len;
+    double const d = -double(dot(un, groupPos[g[0]]));
+    for (auto const group : g)
+      quadrics[group].add_plane(un.x, un.y, un.z, d, 0.5 * len);
+  }
+}
+
+float Simplifier_::simplify(std::vector<std::uint32_t> &aIndices,
+                            std::size_t aTargetIndexCount) {
+  double maxCost = 0.0;
+  while (aIndices.size() > aTargetIndexCount &&
+         simplify_pass_(aIndices, aTargetIndexCount, maxCost))
+    ;
+
+  // The cost is a mean squared distance to the original planes
+  return float(std::sqrt(maxCost));
+}
+
+// One pass collapses an independent set of edges, cheapest first, and then
+// rewrites the index buffer.
+bool Simplifier_::simplify_pass_(std::vector<std::uint32_t> &aIndices,
+                                 std::size_t aTargetIndexCount,
+                                 double &aMaxCost) {
+  std::size_t const triCount = aIndices.size() / 3;
+  std::size_t const groupCount = groupPos.size();
+
+  // Triangles adjacent to each group (compressed rows)
+  std::vector<std::uint32_t> adjStart(groupCount + 1, 0);
+  for (auto const v : aIndices)
+    ++adjStart[groupOf[v] + 1];
+  for (std::size_t g = 0; g < groupCount; ++g)
+    adjStart[g + 1] += adjStart[g];
+
+  std::vector<std::uint32_t> adjTris(aIndices.size());
+  {
+    auto fill = adjStart;
+    for (std::size_t i = 0; i < aIndices.size(); ++i)
+      adjTris[fill[groupOf[aIndices[i]]]++] = std::uint32_t(i / 3);
+  }
+
+  // Edges (in group space) that are not shared by exactly two triangles lie
+  // on a border, or are non-manifold. Their groups stay where they are.
+  std::vector<std::uint64_t> edges;
+  edges.reserve(aIndices.size());
+  for (std::size_t t = 0; t < triCount; ++t) {
+    for (int e = 0; e < 3; ++e) {
+      std::uint64_t a = groupOf[aIndices[t * 3 + e]];
+      std::uint64_t b = groupOf[aIndices[t * 3 + (e + 1) % 3]];
+      if (a > b)
+        std::swap(a, b);
+      edges.push_back(a << 32 | b);
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+
+  std::vector<bool> locked(groupCount, false);
+  std::vector<std::uint64_t> uniqueEdges;
+  uniqueEdges.reserve(edges.size() / 2);
+
+  for (std::size_t i = 0; i < edges.size();) {
+    std::size_t j = i;
+    while (j < edges.size() && edges[j] == edges[i])
+      ++j;
+
+    if (2 != j - i) {
+      locked[edges[i] >> 32] = true;
+      locked[edges[i] & 0xffffffffu] = true;
+    }
+
+    uniqueEdges.push_back(edges[i]);
+    i = j;
+  }
+
+  // Candidate collapses: group a onto group b, in both directions of each
+  // edge
+  struct Collapse_ {
+    double cost;
+    std::uint32_t from, to;
+  };
+
+  std::vector<Collapse_> candidates;
+  candidates.reserve(uniqueEdges.size() * 2);
+  for (auto const edge : uniqueEdges) {
+    auto const a = std::uint32_t(edge >> 32);
+    auto const b = std::uint32_t(edge & 0xffffffffu);
+
+    for (auto const &[from, to] : {std::pair{a, b}, std::pair{b, a}}) {
+      if (locked[from])
+        continue;
+
+      Quadric_ q = quadrics[from];
+      q += quadrics[to];
+      candidates.push_back({q.eval(groupPos[to]), from, to});
+    }
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](Collapse_ const &aA, Collapse_ const &aB) {
+              return aA.cost < aB.cost;
+            });
+
+  std::vector<bool> touched(groupCount, false);
+  std::vector<std::uint32_t> vertexRemap(mesh.positions.size());
+  for (std::size_t v = 0; v < vertexRemap.size(); ++v)
+    vertexRemap[v] = std::uint32_t(v);
+
+  std::size_t remaining = triCount;
+  bool collapsed = false;
+
+  for (auto const &c : candidates) {
+    if (remaining * 3 <= aTargetIndexCount)
+      break;
+    if (touched[c.from] || touched[c.to])
+      continue;
+
+    // Reject collapses that would flip a triangle
+    bool flips = false;
+    std::size_t removed = 0;
+    for (auto k = adjStart[c.from]; k < adjStart[c.from + 1] && !flips; ++k) {
+      auto const *tri = &aIndices[adjTris[k] * 3];
+      std::uint32_t const g[3] = {groupOf[tri[0]], groupOf[tri[1]],
+                                  groupOf[tri[2]]};
+
+      if (g[0] == c.to || g[1] == c.to || g[2] == c.to) {
+        ++removed;
+        continue;
+      }
+
+      Vec3f p[3] = {groupPos[g[0]], groupPos[g[1]], groupPos[g[2]]};
+      Vec3f const before = cross_(p[1] - p[0], p[2] - p[0]);
+      for (int i = 0; i < 3; ++i) {
+        if (g[i] == c.from)
+          p[i] = groupPos[c.to];
+      }
+      Vec3f const after = cross_(p[1] - p[0], p[2] - p[0]);
+
+      flips = dot(before, after) <= 0.f;
+    }
+
+    if (flips)
+      continue;
+
+    // Each vertex of the collapsed group moves to the vertex of the target
+    // group that it shares an edge with, which keeps its attributes on the
+    // same side of any seam.
+    for (auto const v : groupVertices[c.from]) {
+      std::uint32_t target = groupVertices[c.to].front();
+      for (auto k = adjStart[c.from]; k < adjStart[c.from + 1]; ++k) {
+        auto const *tri = &aIndices[adjTris[k] * 3];
+        if (tri[0] != v && tri[1] != v && tri[2] != v)
+          continue;
+
+        for (int i = 0; i < 3; ++i) {
+          if (groupOf[tri[i]] == c.to)
+            target = tri[i];
+        }
+      }
+      vertexRemap[v] = target;
+    }
+
+    quadrics[c.to] += quadrics[c.from];
+    aMaxCost = std::max(aMaxCost, c.cost);
+
+    // Keep the neighbourhood fixed for the rest of the pass, so that the
+    // adjacency computed above remains valid
+    touched[c.from] = touched[c.to] = true;
+    for (auto k = adjStart[c.from]; k < adjStart[c.from + 1]; ++k) {
+      auto const *tri = &aIndices[adjTris[k] * 3];
+      for (int i = 0; i < 3; ++i)
+        touched[groupOf[tri[i]]] = true;
+    }
+
+    remaining -= removed;
+    collapsed = true;
+  }
+
+  if (!collapsed)
+    return false;
+
+  // Rewrite the indices, dropping triangles that became degenerate
+  std::size_t out = 0;
+  for (std::size_t t = 0; t < triCount; ++t) {
+    std::uint32_t const v[3] = {vertexRemap[aIndices[t * 3 + 0]],
+                                vertexRemap[aIndices[t * 3 + 1]],
+                                vertexRemap[aIndices[t * 3 + 2]]};
+
+    if (groupOf[v[0]] == groupOf[v[1]] || groupOf[v[1]] == groupOf[v[2]] ||
+        groupOf[v[0]] == groupOf[v[2]])
+      continue;
+
+    for (int i = 0; i < 3; ++i)
+      aIndices[out++] = v[i];
+  }
+  aIndices.resize(out);
+
+  return true;
+}
+
+// Coarser level of a chain, with indices into the simplified mesh
+struct Level_ {
+  std::vector<std::uint32_t> indices;
+  float error;
+};
+
+// Simplify the mesh's indices into up to aMaxLevels - 1 coarser levels
+std::vector<Level_> simplify_levels_(SimpleMeshData const &aMesh,
+                                     std::size_t aMaxLevels, float aRatio) {
+  Simplifier_ simplifier(aMesh);
+
+  std::vector<Level_> ret;
+  std::vector<std::uint32_t> level = aMesh.indices;
+  float error = 0.f;
+
+  while (ret.size() + 1 < aMaxLevels) {
+    std::size_t const previous = level.size();
+    std::size_t const target = std::size_t(previous * aRatio) / 3 * 3;
+
+    error = std::max(error, simplifier.simplify(level, target));
+
+    // Not worth another level (e.g., because most vertices are locked)
+    if (level.empty() || level.size() > previous * 9 / 10)
+      break;
+
+    ret.push_back({level, error});
+  }
+
+  return ret;
+}
+
+// Number of indices in the full-detail level(s), which come first
+std::size_t full_detail_index_count_(SimpleMeshData const &aMesh) {
+  if (aMesh.lods.empty())
+    return aMesh.indices.size();
+  if (aMesh.chunks.empty())
+    return aMesh.lods.front().indexCount;
+
+  std::size_t ret = 0;
+  for (auto const &chunk : aMesh.chunks)
+    ret += aMesh.lods[chunk.firstLod].indexCount;
+  return ret;
+}
+} // namespace
+
+void build_lod_chain(SimpleMeshData &aMesh, std::size_t aMaxLevels,
+                     float aRatio) {
+  assert(!aMesh.indices.empty());
+
+  // Start over from the full-detail level
+  aMesh.indices.resize(full_detail_index_count_(aMesh));
+  aMesh.chunks.clear();
+
+  aMesh.lods.clear();
+  aMesh.lods.push_back({0, std::uint32_t(aMesh.indices.size()), 0.f});
+
+  for (auto const &level : simplify_levels_(aMesh, aMaxLevels, aRatio)) {
+    aMesh.lods.push_back({std::uint32_t(aMesh.indices.size()),
+                          std::uint32_t(level.indices.size()), level.error});
+    aMesh.indices.insert(aMesh.indices.end(), level.indices.begin(),
+                         level.indices.end());
+  }
+}
+
+void build_lod_chunks(SimpleMeshData &aMesh, std::size_t aChunkTriangles,
+                      std::size_t aMaxLevels, float aRatio) {
+  assert(!aMesh.indices.empty());
+  assert(aChunkTriangles > 0);
+
+  // Start over from the full-detail level
+  aMesh.indices.resize(full_detail_index_count_(aMesh));
+  aMesh.lods.clear();
+  aMesh.chunks.clear();
+
+  std::size_t const triCount = aMesh.indices.size() / 3;
+  auto const grid = std::size_t(
+      std::sqrt(double(triCount) / double(aChunkTriangles)) + 0.5);
+
+  if (grid <= 1) {
+    build_lod_chain(aMesh, aMaxLevels, aRatio);
+    return;
+  }
+
+  // Assign each triangle to a grid cell by its centroid, within the bounds
+  // of the mesh in the XZ plane
+  float minX = std::numeric_limits<float>::max(), maxX = -minX;
+  float minZ = minX, maxZ = -minX;
+  for (auto const &p : aMesh.positions) {
+    minX = std::min(minX, p.x), maxX = std::max(maxX, p.x);
+    minZ = std::min(minZ, p.z), maxZ = std::max(maxZ, p.z);
+  }
+
+  auto cellOf = [grid](float aValue, float aMin, float aMax) {
+    if (!(aMax > aMin))
+      return std::size_t(0);
+    auto const i = std::size_t(std::max(0.f, (aValue - aMin) / (aMax - aMin)) *
+                               float(grid));
+    return std::min(i, grid - 1);
+  };
+
+  std::vector<std::vector<std::uint32_t>> cells(grid * grid);
+  for (std::size_t i = 0; i + 2 < aMesh.indices.size(); i += 3) {
+    auto const *tri = &aMesh.indices[i];
+    Vec3f const c = (aMesh.positions[tri[0]] + aMesh.positions[tri[1]] +
+                     aMesh.positions[tri[2]]) /
+                    3.f;
+
+    auto &cell =
+        cells[cellOf(c.z, minZ, maxZ) * grid + cellOf(c.x, minX, maxX)];
+    cell.insert(cell.end(), tri, tri + 3);
+  }
+
+  cells.erase(std::remove_if(cells.begin(), cells.end(),
+                             [](auto const &aCell) { return aCell.empty(); }),
+              cells.end());
+
+  // The full-detail levels of the chunks come first, so that together they
+  // still form the full-detail level of the whole mesh
+  aMesh.indices.clear();
+
+  std::vector<std::uint32_t> firstIndex;
+  for (auto const &cell : cells) {
+    firstIndex.push_back(std::uint32_t(aMesh.indices.size()));
+    aMesh.indices.insert(aMesh.indices.end(), cell.begin(), cell.end());
+  }
+
+  for (std::size_t c = 0; c < cells.size(); ++c) {
+    // Simplify a compact copy of the chunk. The edges along the chunk's
+    // border are open in the copy, so their vertices stay in place, and
+    // neighbouring chunks at different levels do not crack.
+    SimpleMeshData part;
+    std::vector<std::uint32_t> vertexOf; // part vertex -> mesh vertex
+    std::unordered_map<std::uint32_t, std::uint32_t> partVertex;
+
+    for (auto const v : cells[c]) {
+      auto const [it, inserted] =
+          partVertex.try_emplace(v, std::uint32_t(vertexOf.size()));
+      if (inserted) {
+        vertexOf.push_back(v);
+        part.positions.push_back(aMesh.positions[v]);
+      }
+      part.indices.push_back(it->second);
+    }
+
+    MeshChunk chunk;
+    chunk.bounds =
+        compute_bounding_sphere(part.positions.data(), part.positions.size());
+    chunk.firstLod = std::uint32_t(aMesh.lods.size());
+
+    aMesh.lods.push_back({firstIndex[c], std::uint32_t(cells[c].size()), 0.f});
+    for (auto const &level : simplify_levels_(part, aMaxLevels, aRatio)) {
+      aMesh.lods.push_back({std::uint32_t(aMesh.indices.size()),
+                            std::uint32_t(level.indices.size()), level.error});
+      for (auto const v : level.indices)
+        aMesh.indices.push_back(vertexOf[v]);
+    }
+
+    chunk.lodCount = std::uint32_t(aMesh.lods.size()) - chunk.firstLod;
+    aMesh.chunks.push_back(chunk);
+  }
+}
+
+std::size_t select_lod(std::vector<MeshLod> const &aLods, float aDistance,
+                       float aPixelScale, float aMaxPixelError) {
+  if (aLods.empty())
+    return 0;
+
+  // At zero distance, any error is infinitely large on screen
+  if (aDistance <= 0.f)
+    return 0;
+
+  std::size_t ret = 0;
+  for (std::size_t i = 1; i < aLods.size(); ++i) {
+    if (aLods[i].error * aPixelScale / aDistance > aMaxPixelError)
+      break;
+    ret = i;
+  }
+  return ret;
+}
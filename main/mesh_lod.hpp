@@ -0,0 +1,49 @@
+#ifndef MESH_LOD_HPP_9A2D5F31_7C4E_4B08_A6E3_0F81C4B25D97
+#define MESH_LOD_HPP_9A2D5F31_7C4E_4B08_A6E3_0F81C4B25D97
+
+#include <vector>
+
+#include <cstddef>
+
+#include "simple_mesh.hpp"
+
+/* Level-of-detail chains
+ *
+ * build_lod_chain() simplifies an indexed mesh with quadric error metrics
+ * (Garland & Heckbert), collapsing edges onto existing vertices. Coarser
+ * levels therefore reuse the mesh's vertices and only add indices; all
+ * levels share one vertex buffer and one element buffer, and differ only in
+ * the index range that is drawn (see MeshLod).
+ *
+ * Vertices that share a position (seams between materials, normals or
+ * texture coordinates) are collapsed together, so the simplified mesh does
+ * not crack along seams. Vertices on open borders are kept in place.
+ */
+
+// Replace aMesh.lods by a chain of up to aMaxLevels levels (including the
+// full-detail level), each with about aRatio times the triangles of the
+// previous one. Stops early when a level cannot be reduced much further.
+// The mesh must be indexed.
+void build_lod_chain( SimpleMeshData& aMesh, std::size_t aMaxLevels = 4, float aRatio = 0.5f );
+
+// As build_lod_chain(), but first splits large meshes into a grid of chunks
+// in the XZ plane, with about aChunkTriangles triangles each (assuming that
+// the triangles are spread evenly, as on a terrain). Each chunk gets its own
+// chain and bounds (see MeshChunk). The vertices on the borders between
+// chunks are kept in place, so chunks may be drawn at different levels.
+// Meshes that would not be split into at least two chunks per side remain a
+// single chunk (i.e., aMesh.chunks is left empty).
+void build_lod_chunks( SimpleMeshData& aMesh, std::size_t aChunkTriangles = 16384, std::size_t aMaxLevels = 4, float aRatio = 0.5f );
+
+// Pick the coarsest level whose error, projected to the screen at
+// aDistance from the camera, stays below aMaxPixelError pixels.
+// aPixelScale converts from view-space size at unit distance to pixels,
+// i.e., viewport height / (2 tan(fovy/2)).
+std::size_t select_lod(
+	std::vector<MeshLod> const&,
+	float aDistance,
+	float aPixelScale,
+	float aMaxPixelError = 1.f
+);
+
+#endif // MESH_LOD_HPP_9A2D5F31_7C4E_4B08_A6E3_0F81C4B25D97
@@ -0,0 +1,409 @@
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include <cassert>
+#include <cmath>
+
+namespace {
+// Forsyth's scoring parameters. The cache simulated while scoring is larger
+// than the one the ACMR is measured with; this works better in practice.
+constexpr std::size_t kScoreCacheSize_ = 32;
+constexpr float kLastTriangleScore_ = 0.75f;
+constexpr float kCacheDecayPower_ = 1.5f;
+constexpr float kValenceBoostScale_ = 2.f;
+constexpr float kValenceBoostPower_ = 0.5f;
+
+// Precomputed scores, by cache position (including "not in cache") and by
+// number of remaining triangles
+struct ScoreTables_ {
+  static constexpr std::size_t kMaxValence = 64;
+
+  float cache[kScoreCacheSize_ + 1];
+  float valence[kMaxValence];
+
+  ScoreTables_() {
+    for (std::size_t i = 0; i < kScoreCacheSize_; ++i) {
+      if (i < 3) {
+        // The most recent triangle is likely to be reused, but so would any
+        // of its vertices; don't favour one of them.
+        cache[i] = kLastTriangleScore_;
+      } else {
+        float const scaler = 1.f / (kScoreCacheSize_ - 3);
+        cache[i] = std::pow(1.f - (i - 3) * scaler, kCacheDecayPower_);
+      }
+    }
+    cache[kScoreCacheSize_] = 0.f;
+
+    valence[0] = 0.f;
+    for (std::size_t i = 1; i < kMaxValence; ++i)
+      valence[i] = kValenceBoostScale_ * std::pow(float(i), -kValenceBoostPower_);
+  }
+
+  float score(std::size_t aCachePos, std::size_t aRemaining) const {
+    return cache[aCachePos] +
+           valence[std::min(aRemaining, kMaxValence - 1)];
+  }
+};
+
+// Triangles of each vertex, in compressed-row form
+struct Adjacency_ {
+  std::vector<std::uint32_t> offsets; // per vertex, plus one
+  std::vector<std::uint32_t> triangles;
+
+  Adjacency_(std::uint32_t const *aIndices, std::size_t aIndexCount,
+             std::size_t aVertexCount)
+      : offsets(aVertexCount + 1, 0), triangles(aIndexCount) {
+    for (std::size_t i = 0; i < aIndexCount; ++i)
+      ++offsets[aIndices[i] + 1];
+    for (std::size_t v = 0; v < aVertexCount; ++v)
+      offsets[v + 1] += offsets[v];
+
+    std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < aIndexCount; ++i)
+      triangles[fill[aIndices[i]]++] = std::uint32_t(i / 3);
+  }
+};
+
+// FIFO cache, as used by compute_acmr(). access() returns true on a miss.
+struct FifoCache_ {
+  std::vector<std::uint32_t> timestamps; // per vertex
+  std::uint32_t time;
+  std::uint32_t size;
+
+  FifoCache_(std::size_t aVertexCount, std::size_t aCacheSize)
+      : timestamps(aVertexCount, 0), time(std::uint32_t(aCacheSize) + 1),
+        size(std::uint32_t(aCacheSize)) {}
+
+  bool access(std::uint32_t aVertex) {
+    if (time - timestamps[aVertex] <= size)
+      return false;
+    timestamps[aVertex] = time++;
+    return true;
+  }
+
+  // Empty the cache. Advancing the time past the size ages out every entry,
+  // so this does not touch the timestamps (unless the time would wrap).
+  void reset() {
+    if (time > std::numeric_limits<std::uint32_t>::max() - 2 * (size + 1)) {
+      std::fill(timestamps.begin(), timestamps.end(), 0);
+      time = 0;
+    }
+    time += size + 1;
+  }
+};
+} // namespace
+
+float compute_acmr(std::uint32_t const *aIndices, std::size_t aIndexCount,
+                   std::size_t aVertexCount, std::size_t aCacheSize) {
+  assert(0 == aIndexCount % 3);
+
+  if (0 == aIndexCount)
+    return 0.f;
+
+  FifoCache_ cache(aVertexCount, aCacheSize);
+
+  std::size_t misses = 0;
+  for (std::size_t i = 0; i < aIndexCount; ++i)
+    misses += cache.access(aIndices[i]);
+
+  return float(misses) / float(aIndexCount / 3);
+}
+
+void optimize_vertex_cache(std::uint32_t *aIndices, std::size_t aIndexCount,
+                           std::size_t aVertexCount) {
+  assert(0 == aIndexCount % 3);
+
+  std::size_t const triangleCount = aIndexCount / 3;
+  if (triangleCount < 2)
+    return;
+
+  static ScoreTables_ const tables;
+
+  Adjacency_ adjacency(aIndices, aIndexCount, aVertexCount);
+
+  // Triangles not yet emitted are kept at the front of each vertex's list
+  std::vector<std::uint32_t> remaining(aVertexCount);
+  std::vector<std::uint32_t> cachePos(aVertexCount, kScoreCacheSize_);
+  std::vector<float> vertexScore(aVertexCount);
+
+  for (std::size_t v = 0; v < aVertexCount; ++v) {
+    remaining[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    vertexScore[v] = tables.score(kScoreCacheSize_, remaining[v]);
+  }
+
+  auto const triangle_score = [&](std::uint32_t aTriangle) {
+    return vertexScore[aIndices[aTriangle * 3 + 0]] +
+           vertexScore[aIndices[aTriangle * 3 + 1]] +
+           vertexScore[aIndices[aTriangle * 3 + 2]];
+  };
+
+  std::vector<bool> emitted(triangleCount, false);
+
+  std::vector<std::uint32_t> output;
+  output.reserve(aIndexCount);
+
+  // The cache holds up to three more entries than are scored, so that the
+  // vertices of the last triangle always fit
+  std::vector<std::uint32_t> cache, nextCache;
+  cache.reserve(kScoreCacheSize_ + 3);
+  nextCache.reserve(kScoreCacheSize_ + 3);
+
+  std::size_t cursor = 0; // first triangle that may not have been emitted
+  std::uint32_t best = 0;
+
+  float bestScore = -1.f;
+  for (std::uint32_t t = 0; t < triangleCount; ++t) {
+    if (float const score = triangle_score(t); score > bestScore) {
+      bestScore = score;
+      best = t;
+    }
+  }
+
+  while (output.size() < aIndexCount) {
+    std::uint32_t const *tri = aIndices + best * 3;
+    output.insert(output.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    // Remove the triangle from its vertices' lists
+    for (int k = 0; k < 3; ++k) {
+      std::uint32_t const v = tri[k];
+      auto const first = adjacency.triangles.begin() + adjacency.offsets[v];
+      auto const last = first + remaining[v];
+      auto const it = std::find(first, last, best);
+      assert(it != last);
+      std::iter_swap(it, last - 1);
+      --remaining[v];
+    }
+
+    // New cache: the triangle's vertices, then the old contents
+    nextCache.assign(tri, tri + 3);
+    for (std::uint32_t const v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+        nextCache.push_back(v);
+    }
+    std::swap(cache, nextCache);
+
+    // Update the scores of the vertices in the cache, including the ones
+    // that just dropped out of it, and of their remaining triangles
+    for (std::size_t i = 0; i < cache.size(); ++i) {
+      std::uint32_t const v = cache[i];
+      cachePos[v] = std::uint32_t(std::min(i, kScoreCacheSize_));
+      vertexScore[v] = tables.score(cachePos[v], remaining[v]);
+    }
+
+    bestScore = -1.f;
+    for (std::uint32_t const v : cache) {
+      auto const first = adjacency.offsets[v];
+      for (std::uint32_t j = first; j < first + remaining[v]; ++j) {
+        std::uint32_t const t = adjacency.triangles[j];
+        if (float const score = triangle_score(t); score > bestScore) {
+          bestScore = score;
+          best = t;
+        }
+      }
+    }
+
+    if (cache.size() > kScoreCacheSize_)
+      cache.resize(kScoreCacheSize_);
+
+    // Nothing in the cache has triangles left: continue with any remaining
+    // triangle. Forsyth picks the best-scoring one; the next unemitted one
+    // in input order is almost as good and keeps this linear.
+    if (bestScore < 0.f) {
+      while (cursor < triangleCount && emitted[cursor])
+        ++cursor;
+      if (cursor == triangleCount)
+        break;
+      best = std::uint32_t(cursor);
+    }
+  }
+
+  assert(output.size() == aIndexCount);
+  std::copy(output.begin(), output.end(), aIndices);
+}
+
+void optimize_overdraw(std::uint32_t *aIndices, std::size_t aIndexCount,
+                       std::vector<Vec3f> const &aPositions, float aThreshold) {
+  assert(0 == aIndexCount % 3);
+
+  std::size_t const triangleCount = aIndexCount / 3;
+  if (triangleCount < 2)
+    return;
+
+  std::size_t const vertexCount = aPositions.size();
+
+  // One cache for all passes; resetting it is O(1), whereas a new one would
+  // cost O(vertices) per cluster
+  FifoCache_ cache(vertexCount, kAcmrCacheSize);
+
+  // Hard boundaries: triangles at which all three vertices miss the cache.
+  // Reordering clusters there costs nothing. The misses of each hard
+  // cluster are counted in the same sweep.
+  std::vector<std::size_t> hard, hardMisses;
+  {
+    std::size_t clusterMisses = 0;
+    for (std::size_t t = 0; t < triangleCount; ++t) {
+      unsigned misses = 0;
+      for (int k = 0; k < 3; ++k)
+        misses += cache.access(aIndices[t * 3 + k]);
+
+      if (0 == t || 3 == misses) {
+        if (t)
+          hardMisses.push_back(clusterMisses);
+        hard.push_back(t);
+        clusterMisses = 0;
+      }
+      clusterMisses += misses;
+    }
+    hardMisses.push_back(clusterMisses);
+    hard.push_back(triangleCount);
+  }
+
+  // Soft boundaries: split hard clusters further, wherever the clusters'
+  // cache miss ratio (with a cold cache at their start) stays within
+  // aThreshold of that of the whole hard cluster.
+  std::vector<std::size_t> clusters;
+  for (std::size_t h = 0; h + 1 < hard.size(); ++h) {
+    std::size_t const begin = hard[h], end = hard[h + 1];
+
+    float const clusterAcmr = float(hardMisses[h]) / float(end - begin);
+
+    cache.reset();
+    std::size_t start = begin, misses = 0;
+    clusters.push_back(begin);
+
+    for (std::size_t t = begin; t < end; ++t) {
+      for (int k = 0; k < 3; ++k)
+        misses += cache.access(aIndices[t * 3 + k]);
+
+      std::size_t const count = t - start + 1;
+      if (t + 1 < end && float(misses) <= aThreshold * clusterAcmr * count) {
+        start = t + 1;
+        misses = 0;
+        clusters.push_back(start);
+        cache.reset();
+      }
+    }
+  }
+  clusters.push_back(triangleCount);
+
+  // Sort the clusters by how much they face away from the mesh's centroid
+  Vec3f meshCentroid{0.f, 0.f, 0.f};
+  double meshArea = 0.0;
+
+  struct Cluster_ {
+    std::size_t begin, end;
+    Vec3f centroid, normal;
+    float sortKey;
+  };
+  std::vector<Cluster_> info;
+  info.reserve(clusters.size() - 1);
+
+  for (std::size_t c = 0; c + 1 < clusters.size(); ++c) {
+    Cluster_ cl{clusters[c], clusters[c + 1], {0.f, 0.f, 0.f},
+                {0.f, 0.f, 0.f}, 0.f};
+
+    float area = 0.f;
+    for (std::size_t t = cl.begin; t < cl.end; ++t) {
+      Vec3f const a = aPositions[aIndices[t * 3 + 0]];
+      Vec3f const b = aPositions[aIndices[t * 3 + 1]];
+      Vec3f const d = aPositions[aIndices[t * 3 + 2]];
+
+      Vec3f const e0 = b - a, e1 = d - a;
+      Vec3f const n{e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z,
+                    e0.x * e1.y - e0.y * e1.x};
+      float const triArea = 0.5f * length(n);
+
+      cl.centroid += (a + b + d) * (triArea / 3.f);
+      cl.normal += n;
+      area += triArea;
+    }
+
+    meshCentroid += cl.centroid;
+    meshArea += area;
+
+    if (area > 0.f)
+      cl.centroid = cl.centroid / area;
+    float const nl = length(cl.normal);
+    if (nl > 0.f)
+      cl.normal = cl.normal / nl;
+
+    info.push_back(cl);
+  }
+
+  if (meshArea > 0.0)
+    meshCentroid = meshCentroid / float(meshArea);
+
+  for (auto &cl : info)
+    cl.sortKey = dot(cl.centroid - meshCentroid, cl.normal);
+
+  std::stable_sort(info.begin(), info.end(),
+                   [](Cluster_ const &aLeft, Cluster_ const &aRight) {
+                     return aLeft.sortKey > aRight.sortKey;
+                   });
+
+  std::vector<std::uint32_t> output;
+  output.reserve(aIndexCount);
+  for (auto const &cl : info) {
+    output.insert(output.end(), aIndices + cl.begin * 3,
+                  aIndices + cl.end * 3);
+  }
+
+  std::copy(output.begin(), output.end(), aIndices);
+}
+
+void optimize_vertex_fetch(SimpleMeshData &aMesh) {
+  std::size_t const vertexCount = aMesh.positions.size();
+  constexpr auto kUnused = std::numeric_limits<std::uint32_t>::max();
+
+  std::vector<std::uint32_t> remap(vertexCount, kUnused);
+  std::uint32_t next = 0;
+
+  for (auto &idx : aMesh.indices) {
+    assert(idx < vertexCount);
+    if (kUnused == remap[idx])
+      remap[idx] = next++;
+    idx = remap[idx];
+  }
+
+  auto reorder = [&](auto &aAttrib) {
+    if (aAttrib.size() != vertexCount)
+      return;
+
+    std::remove_reference_t<decltype(aAttrib)> out(next);
+    for (std::size_t v = 0; v < vertexCount; ++v) {
+      if (kUnused != remap[v])
+        out[remap[v]] = aAttrib[v];
+    }
+    aAttrib = std::move(out);
+  };
+
+  reorder(aMesh.positions);
+  reorder(aMesh.colors);
+  reorder(aMesh.normals);
+  reorder(aMesh.texcoords);
+}
+
+void optimize_mesh(SimpleMeshData &aMesh, bool aReduceOverdraw) {
+  assert(!aMesh.indices.empty());
+
+  std::vector<MeshLod> lods = aMesh.lods;
+  if (lods.empty())
+    lods.push_back({0, std::uint32_t(aMesh.indices.size()), 0.f});
+
+  std::size_t const vertexCount = aMesh.positions.size();
+  for (auto const &lod : lods) {
+    std::uint32_t *const indices = aMesh.indices.data() + lod.firstIndex;
+
+    optimize_vertex_cache(indices, lod.indexCount, vertexCount);
+    if (aReduceOverdraw)
+      optimize_overdraw(indices, lod.indexCount, aMesh.positions);
+  }
+
+  // The full-detail level comes first, so its vertices are the most local
+  optimize_vertex_fetch(aMesh);
+}
@@ -0,0 +1,63 @@
+#ifndef MESH_OPTIMIZE_HPP_3E6B1C07_D92A_4F58_8C14_7A0F5B2E96D3
+#define MESH_OPTIMIZE_HPP_3E6B1C07_D92A_4F58_8C14_7A0F5B2E96D3
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "simple_mesh.hpp"
+
+/* Index and vertex order optimisation
+ *
+ * Meshes exported from modelling tools list their triangles in an arbitrary
+ * order, so the GPU's post-transform vertex cache rarely finds a vertex that
+ * it has just transformed. optimize_mesh() reorders the triangles of each
+ * LOD range for cache reuse (Forsyth, "Linear-Speed Vertex Cache
+ * Optimisation"), optionally reorders clusters of triangles so that
+ * outward-facing ones are drawn first to reduce overdraw (Sander et al.,
+ * "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"), and
+ * finally reorders the vertices into the order in which they are first used.
+ *
+ * Efficiency is measured as the average cache miss ratio (ACMR): the number
+ * of vertices transformed per triangle. It ranges from about 0.5 for large
+ * regular grids to 3 when no vertex is ever reused.
+ */
+
+// Size of the FIFO cache simulated by compute_acmr(). Current GPUs do not
+// have a fixed-size FIFO cache, but the ratio still tracks their behaviour.
+constexpr std::size_t kAcmrCacheSize = 16;
+
+float compute_acmr(
+	std::uint32_t const* aIndices,
+	std::size_t aIndexCount,
+	std::size_t aVertexCount,
+	std::size_t aCacheSize = kAcmrCacheSize
+);
+
+// Reorder the triangles of the given index range for vertex cache reuse.
+void optimize_vertex_cache(
+	std::uint32_t* aIndices,
+	std::size_t aIndexCount,
+	std::size_t aVertexCount
+);
+
+// Reorder clusters of triangles in a cache-optimised index range so that
+// triangles facing away from the mesh centre are drawn first. Clusters are
+// split where the cache is already cold, or where the cache miss ratio of
+// the range grows by at most aThreshold.
+void optimize_overdraw(
+	std::uint32_t* aIndices,
+	std::size_t aIndexCount,
+	std::vector<Vec3f> const& aPositions,
+	float aThreshold = 1.05f
+);
+
+// Reorder the vertices in the order of their first use in aMesh.indices,
+// and drop vertices that are not used. Indices are remapped.
+void optimize_vertex_fetch( SimpleMeshData& aMesh );
+
+// All of the above, for each level of detail. The mesh must be indexed.
+void optimize_mesh( SimpleMeshData& aMesh, bool aReduceOverdraw = true );
+
+#endif // MESH_OPTIMIZE_HPP_3E6B1C07_D92A_4F58_8C14_7A0F5B2E96D3
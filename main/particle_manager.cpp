@@ -0,0 +1,220 @@
+#include "particle_manager.hpp"
+
+#include <algorithm>
+
+#include <cmath>
+
+namespace
+{
+	// Emitters nearer than this are treated as this near, so that an
+	// emitter around the camera does not get an infinite size on screen
+	constexpr float kMinDistance_ = 0.1f;
+
+	// Whether the sphere is at least partly inside the frustum of
+	// aProjCameraWorld. The planes are combinations of the matrix' rows
+	// (Gribb & Hartmann); they are not normalized, so the radius is scaled
+	// by the length of their normals instead.
+	bool sphere_visible_(const Mat44f& aProjCameraWorld, const BoundingSphere& aSphere)
+	{
+		const Mat44f& m = aProjCameraWorld;
+		for (std::size_t row = 0; row < 3; ++row)
+		{
+			for (float sign : { 1.0f, -1.0f })
+			{
+				Vec3f const normal{
+					m(3, 0) + sign * m(row, 0),
+					m(3, 1) + sign * m(row, 1),
+					m(3, 2) + sign * m(row, 2)
+				};
+				float const offset = m(3, 3) + sign * m(row, 3);
+
+				float const distance = normal.x * aSphere.center.x + normal.y * aSphere.center.y + normal.z * aSphere.center.z + offset;
+				if (distance < -aSphere.radius * length(normal))
+					return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+ParticleManager::ParticleManager(std::size_t poolSize, ParticleSimulation simulation, ParticleOverflow overflow, ParticleShape shape)
+	: system(poolSize, simulation, overflow, shape)
+{
+}
+
+ParticleEmitterId ParticleManager::AddEmitter(const ParticleEmitter& emitter, const ParticleEmitterParams& emitterParams)
+{
+	ParticleEmitterId const id = ParticleEmitterId(emitters.size());
+
+	emitters.push_back(emitter);
+	params.push_back(emitterParams);
+	lods.emplace_back();
+	system.SetEmitterParams(id, emitterParams);
+
+	return id;
+}
+
+void ParticleManager::SetParams(ParticleEmitterId id, const ParticleEmitterParams& emitterParams)
+{
+	params[id] = emitterParams;
+	system.SetEmitterParams(id, emitterParams);
+}
+
+void ParticleManager::Update(float ts)
+{
+	UpdateLod(ts, nullptr);
+	Simulate(ts);
+}
+
+void ParticleManager::Update(float ts, const ParticleView& view)
+{
+	UpdateLod(ts, &view);
+	Simulate(ts);
+}
+
+// Decide each emitter's visibility and rate, and its particles' size
+void ParticleManager::UpdateLod(float ts, const ParticleView* view)
+{
+	stats = ParticleBudgetStats{};
+
+	for (std::size_t i = 0; i < emitters.size(); ++i)
+	{
+		const ParticleEmitter& emitter = emitters[i];
+		EmitterLod& lod = lods[i];
+
+		float rateScale = 1.0f, sizeScale = 1.0f;
+		float particleCost = kParticleFixedCost;
+
+		if (view)
+		{
+			// Level of detail may enlarge the particles up to this much
+			float const maxSizeScale = emitter.LodPixels > 0.0f ? 1.0f / std::sqrt(emitter.MinRateScale) : 1.0f;
+			BoundingSphere const bounds = particle_emitter_bounds(emitter, params[i].SizeScale * maxSizeScale);
+
+			if (!sphere_visible_(view->ProjCameraWorld, bounds))
+			{
+				lod.OffscreenFor += ts;
+				lod.RateScale = 0.0f;
+				continue;
+			}
+
+			Vec4f const center = view->CameraWorld * Vec4f{ bounds.center.x, bounds.center.y, bounds.center.z, 1.0f };
+			float const distance = std::max(length(Vec3f{ center.x, center.y, center.z }), kMinDistance_);
+			float const pixelsPerUnit = view->PixelScale / distance;
+
+			// Fewer particles in proportion to the area on screen; larger
+			// ones, so that they cover the same area together
+			if (emitter.LodPixels > 0.0f)
+			{
+				float const coverage = bounds.radius * pixelsPerUnit / emitter.LodPixels;
+				rateScale = std::clamp(coverage * coverage, emitter.MinRateScale, 1.0f);
+				sizeScale = 1.0f / std::sqrt(rateScale);
+			}
+
+			float const size = 0.5f * (emitter.Init.SizeBegin + emitter.Init.SizeEnd);
+			float const edge = kParticleShapeSize * size * params[i].SizeScale * sizeScale * pixelsPerUnit;
+			particleCost += edge * edge;
+		}
+
+		lod.OffscreenFor = 0.0f;
+		lod.RateScale = rateScale;
+		lod.SizeScale = sizeScale;
+
+		// Alive at once, when spawning steadily at this rate
+		float const particles = emitter.Rate * rateScale * emitter.Init.LifeTime;
+
+		++stats.VisibleEmitters;
+		stats.EstimatedParticles += particles;
+		stats.EstimatedCost += particles * particleCost;
+	}
+
+	// All visible emitters give up the same share of their particles
+	float scale = 1.0f;
+	if (stats.EstimatedParticles > float(budget.MaxParticles))
+		scale = float(budget.MaxParticles) / stats.EstimatedParticles;
+	if (view && stats.EstimatedCost * scale > budget.MaxCost)
+		scale = budget.MaxCost / stats.EstimatedCost;
+
+	if (scale < 1.0f)
+	{
+		for (EmitterLod& lod : lods)
+			lod.RateScale *= scale;
+
+		stats.EstimatedParticles *= scale;
+		stats.EstimatedCost *= scale;
+		stats.BudgetScale = scale;
+	}
+}
+
+void ParticleManager::Simulate(float ts)
+{
+	// Particles of an emitter that has been off screen for longer than they
+	// live were all spawned off screen
+	bool anyVisible = emitters.empty();
+	for (std::size_t i = 0; i < emitters.size(); ++i)
+		anyVisible = anyVisible || lods[i].OffscreenFor <= emitters[i].Init.LifeTime;
+
+	stats.Simulated = anyVisible;
+	if (!stats.Simulated)
+	{
+		// Particles move in straight lines, so the skipped time can be
+		// made up in one step
+		skippedTime += ts;
+		return;
+	}
+
+	system.Update(ts + skippedTime);
+	skippedTime = 0.0f;
+
+	// With gpu simulation, the spawns of all emitters are collected, and
+	// emitted by one dispatch in Render()
+	for (std::size_t i = 0; i < emitters.size(); ++i)
+	{
+		if (0.0f == lods[i].RateScale)
+			continue;
+
+		// The level of detail enlarges particles as they are spawned, so
+		// that the live ones keep their size while it changes, and the
+		// emitter's draw settings stay the same
+		ParticleInit init = emitters[i].Init;
+		init.SizeBegin *= lods[i].SizeScale;
+		init.SizeEnd *= lods[i].SizeScale;
+		init.SizeVariation *= lods[i].SizeScale;
+
+		system.Spawn(init, emitters[i].Advance(ts, lods[i].RateScale), ParticleEmitterId(i));
+	}
+}
+
+void ParticleManager::Render(Mat44f projCameraWorld, Mat44f cameraWorld)
+{
+	if (!stats.Simulated)
+		return;
+
+	system.Render(projCameraWorld, cameraWorld);
+}
+
+void ParticleManager::Render(Mat44f projCameraWorld, Mat44f cameraWorld, ParticleResolution resolution)
+{
+	if (!stats.Simulated)
+		return;
+
+	system.Render(projCameraWorld, cameraWorld, resolution);
+}
+
+BoundingSphere particle_emitter_bounds(const ParticleEmitter& emitter, float sizeScale)
+{
+	const ParticleInit& init = emitter.Init;
+
+	// Particles start within a box of PositionVariation around Position,
+	// and move by up to half of VelocityVariation off Velocity
+	Vec3f const center = init.Position + init.Velocity * (0.5f * init.LifeTime);
+	float const spread = 0.5f * length(init.PositionVariation) + 0.5f * length(init.Velocity) * init.LifeTime
+		+ 0.5f * length(init.VelocityVariation) * init.LifeTime;
+
+	// Half the diagonal of the largest cube
+	float const size = std::max(init.SizeBegin, init.SizeEnd) * sizeScale;
+	float const extent = 0.5f * std::sqrt(3.0f) * kParticleShapeSize * size;
+
+	return BoundingSphere{ center, spread + extent };
+}
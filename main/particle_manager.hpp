@@ -0,0 +1,133 @@
+#ifndef PARTICLE_MANAGER_HPP_E3A61F09_7C24_4B8D_9F53_0D2B8C6E4A71
+#define PARTICLE_MANAGER_HPP_E3A61F09_7C24_4B8D_9F53_0D2B8C6E4A71
+
+#include "particle_system.hpp"
+#include "simple_mesh.hpp"
+
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Index of an emitter within its ParticleManager
+using ParticleEmitterId = std::uint32_t;
+
+// Camera that level of detail, culling and cost estimates are relative to
+struct ParticleView
+{
+	Mat44f ProjCameraWorld;
+	Mat44f CameraWorld;
+	// Pixels per unit of view-space size at unit distance, i.e., viewport
+	// height / (2 tan(fovy/2)), as for select_lod()
+	float PixelScale;
+};
+
+// Bounds on all emitters of a ParticleManager together. Cost is estimated
+// in pixels shaded per frame, from the particles' size on screen; each
+// particle also counts kParticleFixedCost for its simulation and vertices.
+// When either bound would be exceeded, all emitters spawn proportionally
+// fewer particles.
+struct ParticleBudget
+{
+	std::size_t MaxParticles = std::numeric_limits<std::size_t>::max();
+	float MaxCost = std::numeric_limits<float>::infinity();
+};
+
+constexpr float kParticleFixedCost = 16.0f;
+
+// What the last Update() decided
+struct ParticleBudgetStats
+{
+	std::size_t VisibleEmitters = 0;
+	float EstimatedParticles = 0.0f; // alive at the current rates
+	float EstimatedCost = 0.0f;
+	float BudgetScale = 1.0f; // of the visible emitters' rates
+	bool Simulated = true; // false if only the clock was advanced
+};
+
+/* Many emitters, one particle system
+ *
+ * All emitters spawn into the same pool, so that the particles of every
+ * effect are aged in a single update pass and drawn with a single instanced
+ * draw call. Each particle records its emitter's id, which the draw uses to
+ * look up the emitter's ParticleEmitterParams.
+ *
+ * Given a ParticleView, Update() also culls and scales the emitters:
+ *  - Emitters whose bounds (where the particles they spawn now can travel)
+ *    are outside the view frustum spawn nothing, and do not make up for it
+ *    once visible again. Once every emitter has been off screen for longer
+ *    than its particles live, the pool holds no visible particles, and
+ *    simulating and drawing are skipped; only the skipped time is kept,
+ *    and added to the next update that does run.
+ *  - Visible emitters with a LodPixels spawn fewer, larger particles when
+ *    small on screen (see ParticleEmitter).
+ *  - The rates are then scaled to stay within the ParticleBudget.
+ *
+ * Emitters are never removed; an emitter with a zero Rate spawns nothing.
+ */
+class ParticleManager
+{
+public:
+    // Shared pool with room for poolSize particles, see ParticleSystem
+    explicit ParticleManager(std::size_t poolSize = 1000, ParticleSimulation simulation = ParticleSimulation::cpu, ParticleOverflow overflow = ParticleOverflow::stealOldest, ParticleShape shape = ParticleShape::cube);
+
+    ParticleEmitterId AddEmitter(const ParticleEmitter& emitter, const ParticleEmitterParams& params = {});
+
+    // The emitter's particle settings and rate, which may be changed at
+    // any time; changes apply to particles spawned afterwards
+    ParticleEmitter& Emitter(ParticleEmitterId id) { return emitters[id]; }
+    const ParticleEmitter& Emitter(ParticleEmitterId id) const { return emitters[id]; }
+    std::size_t EmitterCount() const { return emitters.size(); }
+
+    // Draw settings, which apply to the emitter's live particles as well.
+    // The level of detail does not change them; it scales the size of the
+    // particles that are spawned instead.
+    void SetParams(ParticleEmitterId id, const ParticleEmitterParams& params);
+    const ParticleEmitterParams& Params(ParticleEmitterId id) const { return params[id]; }
+
+    void SetBudget(const ParticleBudget& budget) { this->budget = budget; }
+    const ParticleBudget& Budget() const { return budget; }
+    const ParticleBudgetStats& Stats() const { return stats; }
+
+    // Age all particles, then spawn the particles each emitter has due
+    // after ts seconds. Without a view, all emitters count as visible and
+    // at full detail, and only MaxParticles is enforced.
+    void Update(float ts);
+    void Update(float ts, const ParticleView& view);
+
+    // Draw the particles of all emitters, see ParticleSystem::Render()
+    void Render(Mat44f projCameraWorld, Mat44f cameraWorld = kIdentity44f);
+    // Draw the particles of the emitters drawn at resolution only
+    void Render(Mat44f projCameraWorld, Mat44f cameraWorld, ParticleResolution resolution);
+    bool UsesResolution(ParticleResolution resolution) const { return system.UsesResolution(resolution); }
+
+    // For the settings that apply to all emitters (sort, blend)
+    ParticleSystem& System() { return system; }
+    const ParticleSystem& System() const { return system; }
+private:
+	// Per emitter, as decided by the last Update()
+	struct EmitterLod
+	{
+		float OffscreenFor = 0.0f; // seconds; 0 while visible
+		float RateScale = 1.0f; // level of detail and budget
+		float SizeScale = 1.0f; // level of detail, of the particles spawned
+	};
+
+	void UpdateLod(float ts, const ParticleView* view);
+	void Simulate(float ts);
+
+	ParticleSystem system;
+	std::vector<ParticleEmitter> emitters;
+	std::vector<ParticleEmitterParams> params;
+	std::vector<EmitterLod> lods;
+
+	ParticleBudget budget;
+	ParticleBudgetStats stats;
+	float skippedTime = 0.0f;
+};
+
+// Sphere that contains all particles the emitter spawns now, over their
+// whole life, at their largest size (times sizeScale)
+BoundingSphere particle_emitter_bounds(const ParticleEmitter& emitter, float sizeScale = 1.0f);
+
+#endif // PARTICLE_MANAGER_HPP_E3A61F09_7C24_4B8D_9F53_0D2B8C6E4A71
@@ -0,0 +1,195 @@
+#include "particle_offscreen.hpp"
+
+#include "../support/error.hpp"
+
+#include "particle_oit.hpp"
+
+namespace {
+GLuint create_target_(GLenum aFormat, GLsizei aWidth, GLsizei aHeight) {
+  GLuint tex = 0;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexStorage2D(GL_TEXTURE_2D, 1, aFormat, aWidth, aHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  return tex;
+}
+
+bool has_stencil_(GLenum aDepthFormat) {
+  return GL_DEPTH24_STENCIL8 == aDepthFormat ||
+         GL_DEPTH32F_STENCIL8 == aDepthFormat;
+}
+
+void check_complete_() {
+  GLenum const status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+  if (GL_FRAMEBUFFER_COMPLETE != status)
+    throw Error("ParticleOffscreen: framebuffer is incomplete (%#x)", status);
+}
+} // namespace
+
+ParticleOffscreen::ParticleOffscreen() {
+  mDownsample = &get_program(
+      {{GL_VERTEX_SHADER, "assets/particle_oit_composite.vert"},
+       {GL_FRAGMENT_SHADER, "assets/particle_offscreen_downsample.frag"}});
+  mUpsample = &get_program(
+      {{GL_VERTEX_SHADER, "assets/particle_oit_composite.vert"},
+       {GL_FRAGMENT_SHADER, "assets/particle_offscreen_upsample.frag"}});
+
+  glGenVertexArrays(1, &mFullScreenVA);
+}
+
+ParticleOffscreen::~ParticleOffscreen() {
+  GLuint const framebuffers[] = {mFullFramebuffer, mFramebuffer};
+  glDeleteFramebuffers(2, framebuffers);
+  GLuint const textures[] = {mFullDepth, mColor, mDepth};
+  glDeleteTextures(3, textures);
+  glDeleteVertexArrays(1, &mFullScreenVA);
+}
+
+void ParticleOffscreen::create_targets_(GLsizei aWidth, GLsizei aHeight,
+                                        GLsizei aFactor) {
+  GLuint const framebuffers[] = {mFullFramebuffer, mFramebuffer};
+  glDeleteFramebuffers(2, framebuffers);
+  GLuint const textures[] = {mFullDepth, mColor, mDepth};
+  glDeleteTextures(3, textures);
+
+  // Round up, so that the low resolution target covers the whole viewport
+  GLsizei const width = (aWidth + aFactor - 1) / aFactor;
+  GLsizei const height = (aHeight + aFactor - 1) / aFactor;
+
+  mFullDepth = create_target_(mDepthFormat, aWidth, aHeight);
+  mColor = create_target_(GL_RGBA16F, width, height);
+  mDepth = create_target_(GL_DEPTH_COMPONENT32F, width, height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &mFullFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFullFramebuffer);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
+                         has_stencil_(mDepthFormat) ? GL_DEPTH_STENCIL_ATTACHMENT
+                                                    : GL_DEPTH_ATTACHMENT,
+                         GL_TEXTURE_2D, mFullDepth, 0);
+  glDrawBuffer(GL_NONE);
+  check_complete_();
+
+  glGenFramebuffers(1, &mFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, mColor, 0);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                         GL_TEXTURE_2D, mDepth, 0);
+  check_complete_();
+
+  mWidth = aWidth;
+  mHeight = aHeight;
+  mFactor = aFactor;
+}
+
+void ParticleOffscreen::begin(ParticleResolution aResolution) {
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &mPrevDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &mPrevReadFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, mPrevViewport);
+
+  GLenum const depthFormat = bound_depth_format(mPrevDrawFramebuffer);
+  if (GL_NONE == depthFormat)
+    throw Error("ParticleOffscreen: the framebuffer has no depth buffer");
+
+  GLsizei const factor = ParticleResolution::quarter == aResolution ? 4 : 2;
+  GLsizei const width = mPrevViewport[2], height = mPrevViewport[3];
+  if (width != mWidth || height != mHeight || factor != mFactor ||
+      depthFormat != mDepthFormat || !mFramebuffer) {
+    mDepthFormat = depthFormat;
+    create_targets_(width, height, factor);
+  }
+
+  // Copy the depth of what was drawn so far. The blit cannot reduce it to
+  // the nearest depth of each block, so the copy is downsampled in a pass
+  // of its own.
+  GLint const x = mPrevViewport[0], y = mPrevViewport[1];
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(mPrevDrawFramebuffer));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFullFramebuffer);
+  glBlitFramebuffer(x, y, x + width, y + height, 0, 0, width, height,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+  mPrevBlend = glIsEnabled(GL_BLEND);
+  mPrevDepthTest = glIsEnabled(GL_DEPTH_TEST);
+  glGetBooleanv(GL_DEPTH_WRITEMASK, &mPrevDepthMask);
+  glGetIntegerv(GL_DEPTH_FUNC, &mPrevDepthFunc);
+  glGetIntegerv(GL_BLEND_SRC_RGB, &mPrevBlendFunc[0]);
+  glGetIntegerv(GL_BLEND_DST_RGB, &mPrevBlendFunc[1]);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &mPrevBlendFunc[2]);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &mPrevBlendFunc[3]);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+  glViewport(0, 0, (width + factor - 1) / factor,
+             (height + factor - 1) / factor);
+
+  // The downsample pass writes depth only; it must pass everywhere
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_ALWAYS);
+  glDepthMask(GL_TRUE);
+
+  glUseProgram(mDownsample->programId());
+  glUniform1i(0, factor);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, mFullDepth);
+
+  glBindVertexArray(mFullScreenVA);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+
+  // Nothing drawn, everything transmitted
+  GLfloat const clear[4] = {0.f, 0.f, 0.f, 1.f};
+  glClearBufferfv(GL_COLOR, 0, clear);
+
+  // Premultiplied color over what is behind; product of (1 - alpha)
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO,
+                      GL_ONE_MINUS_SRC_ALPHA);
+
+  // Test against the downsampled depth, which the upsample reads as well
+  glDepthFunc(GLenum(mPrevDepthFunc));
+  glDepthMask(GL_FALSE);
+}
+
+void ParticleOffscreen::end() {
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(mPrevDrawFramebuffer));
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(mPrevReadFramebuffer));
+  glViewport(mPrevViewport[0], mPrevViewport[1], mPrevViewport[2],
+             mPrevViewport[3]);
+
+  // The upsample outputs the premultiplied color, and the transmittance as
+  // alpha
+  glDisable(GL_DEPTH_TEST);
+  glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+
+  glUseProgram(mUpsample->programId());
+  glUniform1i(0, mFactor);
+  glUniform2i(1, mPrevViewport[0], mPrevViewport[1]);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, mFullDepth);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, mDepth);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, mColor);
+
+  glBindVertexArray(mFullScreenVA);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+
+  for (GLenum unit : {GL_TEXTURE2, GL_TEXTURE1, GL_TEXTURE0}) {
+    glActiveTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  if (!mPrevBlend)
+    glDisable(GL_BLEND);
+  if (mPrevDepthTest)
+    glEnable(GL_DEPTH_TEST);
+  glDepthMask(mPrevDepthMask);
+  glBlendFuncSeparate(GLenum(mPrevBlendFunc[0]), GLenum(mPrevBlendFunc[1]),
+                      GLenum(mPrevBlendFunc[2]), GLenum(mPrevBlendFunc[3]));
+}
@@ -0,0 +1,74 @@
+#ifndef PARTICLE_OFFSCREEN_HPP_4B9D2E67_13A8_4C5F_B0E2_6F81D3A7C925
+#define PARTICLE_OFFSCREEN_HPP_4B9D2E67_13A8_4C5F_B0E2_6F81D3A7C925
+
+#include <glad.h>
+
+#include "../support/program.hpp"
+
+#include "particle_system.hpp"
+
+/* Off-screen particles (Cantlay, "High-Speed, Off-Screen Particles", GPU
+ * Gems 3, chapter 23)
+ *
+ * Between begin() and end(), alpha blended geometry is drawn into a target
+ * with half or a quarter of the viewport's width and height. begin() fills
+ * the target's depth buffer with the nearest depth of each block of pixels
+ * in the framebuffer's depth buffer, so that the geometry is hidden behind
+ * what was drawn already. The color target accumulates the blended colors,
+ * premultiplied, and the product of (1 - alpha) in its alpha channel.
+ *
+ * end() upsamples the result onto the framebuffer. Each pixel blends the
+ * four nearest low resolution texels, weighted by their distance and by
+ * how close their depth is to the pixel's own, which keeps particles from
+ * bleeding across the silhouettes of nearer geometry.
+ *
+ * The framebuffer that is bound at begin() must have a depth buffer, and
+ * must not be multisampled.
+ */
+class ParticleOffscreen final
+{
+	public:
+		ParticleOffscreen();
+		~ParticleOffscreen();
+
+		ParticleOffscreen( ParticleOffscreen const& ) = delete;
+		ParticleOffscreen& operator= (ParticleOffscreen const&) = delete;
+
+	public:
+		// Redirect drawing to targets of the current viewport's size,
+		// divided according to aResolution (which must not be full), and
+		// set up blending
+		void begin( ParticleResolution aResolution );
+
+		// Upsample onto the framebuffer that was bound at begin(), within
+		// the viewport at the time, and restore the viewport, blend and
+		// depth state
+		void end();
+
+	private:
+		void create_targets_( GLsizei aWidth, GLsizei aHeight, GLsizei aFactor );
+
+		// Copy of the framebuffer's depth, within the viewport
+		GLuint mFullFramebuffer = 0;
+		GLuint mFullDepth = 0; // texture, same format as the framebuffer's
+		GLenum mDepthFormat = GL_NONE;
+
+		// Low resolution targets
+		GLuint mFramebuffer = 0;
+		GLuint mColor = 0, mDepth = 0; // textures
+		GLsizei mWidth = 0, mHeight = 0; // of the viewport
+		GLsizei mFactor = 0; // viewport size / target size
+
+		GLuint mFullScreenVA = 0; // no attributes
+		ShaderProgram* mDownsample = nullptr;
+		ShaderProgram* mUpsample = nullptr;
+
+		// Framebuffers and pipeline state at begin()
+		GLint mPrevDrawFramebuffer = 0, mPrevReadFramebuffer = 0;
+		GLint mPrevViewport[4] = {};
+		GLboolean mPrevBlend = GL_FALSE, mPrevDepthTest = GL_FALSE, mPrevDepthMask = GL_TRUE;
+		GLint mPrevDepthFunc = GL_LESS;
+		GLint mPrevBlendFunc[4] = {}; // source and destination, RGB and alpha
+};
+
+#endif // PARTICLE_OFFSCREEN_HPP_4B9D2E67_13A8_4C5F_B0E2_6F81D3A7C925
@@ -0,0 +1,190 @@
+#include "particle_oit.hpp"
+
+#include "../support/error.hpp"
+
+GLenum bound_depth_format(GLint aFramebuffer) {
+  GLenum const depth = 0 == aFramebuffer ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+  GLenum const stencil = 0 == aFramebuffer ? GL_STENCIL : GL_STENCIL_ATTACHMENT;
+
+  GLint type = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(
+      GL_DRAW_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+  if (GL_NONE == type)
+    return GL_NONE;
+
+  GLint depthBits = 0, componentType = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(
+      GL_DRAW_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE,
+      &depthBits);
+  glGetFramebufferAttachmentParameteriv(
+      GL_DRAW_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE,
+      &componentType);
+
+  GLint stencilBits = 0;
+  glGetFramebufferAttachmentParameteriv(
+      GL_DRAW_FRAMEBUFFER, stencil, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE,
+      &type);
+  if (GL_NONE != type) {
+    glGetFramebufferAttachmentParameteriv(
+        GL_DRAW_FRAMEBUFFER, stencil, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE,
+        &stencilBits);
+  }
+
+  if (GL_FLOAT == componentType)
+    return stencilBits ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+  if (depthBits > 24)
+    return GL_DEPTH_COMPONENT32;
+  if (depthBits > 16)
+    return stencilBits ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+  return GL_DEPTH_COMPONENT16;
+}
+
+namespace {
+GLuint create_target_(GLenum aFormat, GLsizei aWidth, GLsizei aHeight) {
+  GLuint tex = 0;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexStorage2D(GL_TEXTURE_2D, 1, aFormat, aWidth, aHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  return tex;
+}
+} // namespace
+
+ParticleOit::ParticleOit() {
+  mComposite = &get_program(
+      {{GL_VERTEX_SHADER, "assets/particle_oit_composite.vert"},
+       {GL_FRAGMENT_SHADER, "assets/particle_oit_composite.frag"}});
+
+  glGenVertexArrays(1, &mCompositeVA);
+}
+
+ParticleOit::~ParticleOit() {
+  glDeleteFramebuffers(1, &mFramebuffer);
+  GLuint const textures[] = {mAccumulation, mRevealage};
+  glDeleteTextures(2, textures);
+  glDeleteRenderbuffers(1, &mDepth);
+  glDeleteVertexArrays(1, &mCompositeVA);
+}
+
+void ParticleOit::create_targets_(GLsizei aWidth, GLsizei aHeight) {
+  glDeleteFramebuffers(1, &mFramebuffer);
+  GLuint const textures[] = {mAccumulation, mRevealage};
+  glDeleteTextures(2, textures);
+  glDeleteRenderbuffers(1, &mDepth);
+  mDepth = 0;
+
+  mAccumulation = create_target_(GL_RGBA16F, aWidth, aHeight);
+  mRevealage = create_target_(GL_R8, aWidth, aHeight);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &mFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, mAccumulation, 0);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                         GL_TEXTURE_2D, mRevealage, 0);
+
+  if (GL_NONE != mDepthFormat) {
+    glGenRenderbuffers(1, &mDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, mDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, mDepthFormat, aWidth, aHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    bool const hasStencil = GL_DEPTH24_STENCIL8 == mDepthFormat ||
+                            GL_DEPTH32F_STENCIL8 == mDepthFormat;
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER,
+                              hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT
+                                         : GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, mDepth);
+  }
+
+  GLenum const buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, buffers);
+
+  GLenum const status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+  if (GL_FRAMEBUFFER_COMPLETE != status)
+    throw Error("ParticleOit: framebuffer is incomplete (%#x)", status);
+
+  mWidth = aWidth;
+  mHeight = aHeight;
+}
+
+void ParticleOit::begin(GLsizei aWidth, GLsizei aHeight) {
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &mPrevDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &mPrevReadFramebuffer);
+
+  GLenum const depthFormat = bound_depth_format(mPrevDrawFramebuffer);
+  if (aWidth != mWidth || aHeight != mHeight || depthFormat != mDepthFormat ||
+      !mFramebuffer) {
+    mDepthFormat = depthFormat;
+    create_targets_(aWidth, aHeight);
+  }
+
+  // Copy the depth of what was drawn so far
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(mPrevDrawFramebuffer));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFramebuffer);
+  if (GL_NONE != mDepthFormat) {
+    glBlitFramebuffer(0, 0, aWidth, aHeight, 0, 0, aWidth, aHeight,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  }
+
+  // Nothing accumulated, everything revealed
+  GLfloat const zero[4] = {0.f, 0.f, 0.f, 0.f};
+  GLfloat const one[4] = {1.f, 1.f, 1.f, 1.f};
+  glClearBufferfv(GL_COLOR, 0, zero);
+  glClearBufferfv(GL_COLOR, 1, one);
+
+  mPrevBlend = glIsEnabled(GL_BLEND);
+  mPrevDepthTest = glIsEnabled(GL_DEPTH_TEST);
+  glGetBooleanv(GL_DEPTH_WRITEMASK, &mPrevDepthMask);
+  glGetIntegerv(GL_BLEND_SRC_RGB, &mPrevBlendFunc[0]);
+  glGetIntegerv(GL_BLEND_DST_RGB, &mPrevBlendFunc[1]);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &mPrevBlendFunc[2]);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &mPrevBlendFunc[3]);
+
+  // Sum of weighted colors; product of (1 - alpha)
+  glEnable(GL_BLEND);
+  glBlendFunci(0, GL_ONE, GL_ONE);
+  glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+
+  // Test against the copied depth, but let all layers through
+  if (GL_NONE != mDepthFormat)
+    glEnable(GL_DEPTH_TEST);
+  else
+    glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+}
+
+void ParticleOit::end() {
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(mPrevDrawFramebuffer));
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(mPrevReadFramebuffer));
+
+  // The composite pass outputs the average color, with an alpha of
+  // 1 - revealage
+  glDisable(GL_DEPTH_TEST);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glUseProgram(mComposite->programId());
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, mRevealage);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, mAccumulation);
+
+  glBindVertexArray(mCompositeVA);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  if (!mPrevBlend)
+    glDisable(GL_BLEND);
+  if (mPrevDepthTest)
+    glEnable(GL_DEPTH_TEST);
+  glDepthMask(mPrevDepthMask);
+  glBlendFuncSeparate(GLenum(mPrevBlendFunc[0]), GLenum(mPrevBlendFunc[1]),
+                      GLenum(mPrevBlendFunc[2]), GLenum(mPrevBlendFunc[3]));
+}
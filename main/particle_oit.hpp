@@ -0,0 +1,67 @@
+#ifndef PARTICLE_OIT_HPP_7E1C4A93_0B5D_4D28_86F2_A93E5C1D7B40
+#define PARTICLE_OIT_HPP_7E1C4A93_0B5D_4D28_86F2_A93E5C1D7B40
+
+#include <glad.h>
+
+#include "../support/program.hpp"
+
+/* Weighted blended order-independent transparency (McGuire & Bavoil, 2013)
+ *
+ * Between begin() and end(), transparent geometry is drawn into two
+ * offscreen targets instead of the framebuffer: premultiplied colors,
+ * weighted by depth and opacity, are summed into an RGBA16F accumulation
+ * target, and the product of (1 - alpha) into an R8 revealage target. end()
+ * resolves both onto the framebuffer with a single full-screen pass. The
+ * result does not depend on the drawing order, so nothing needs to be
+ * sorted; in return, it only approximates correct blending where many
+ * layers of similar depth overlap.
+ *
+ * Fragment shaders must write the accumulation color to output 0 and the
+ * alpha to output 1 (see assets/particle_oit.frag).
+ *
+ * The depth buffer of the framebuffer that is bound at begin() is copied,
+ * so that the transparent geometry is hidden behind what was drawn already.
+ * It must not be multisampled.
+ */
+class ParticleOit final
+{
+	public:
+		ParticleOit();
+		~ParticleOit();
+
+		ParticleOit( ParticleOit const& ) = delete;
+		ParticleOit& operator= (ParticleOit const&) = delete;
+
+	public:
+		// Redirect drawing to the targets, which are (re)allocated to the
+		// framebuffer's size aWidth x aHeight, and set up blending
+		void begin( GLsizei aWidth, GLsizei aHeight );
+
+		// Composite onto the framebuffer that was bound at begin(), within
+		// the current viewport, and restore the blend and depth state
+		void end();
+
+	private:
+		void create_targets_( GLsizei aWidth, GLsizei aHeight );
+
+		GLuint mFramebuffer = 0;
+		GLuint mAccumulation = 0, mRevealage = 0; // textures
+		GLuint mDepth = 0; // renderbuffer, same format as the framebuffer's
+		GLenum mDepthFormat = GL_NONE;
+		GLsizei mWidth = 0, mHeight = 0;
+
+		GLuint mCompositeVA = 0; // no attributes
+		ShaderProgram* mComposite = nullptr;
+
+		// Framebuffers and pipeline state at begin()
+		GLint mPrevDrawFramebuffer = 0, mPrevReadFramebuffer = 0;
+		GLboolean mPrevBlend = GL_FALSE, mPrevDepthTest = GL_FALSE, mPrevDepthMask = GL_TRUE;
+		GLint mPrevBlendFunc[4] = {}; // source and destination, RGB and alpha
+};
+
+// Format of the depth buffer of aFramebuffer, which must be bound for
+// drawing (0 is the default framebuffer), or GL_NONE if it has none. Depth
+// can only be blitted between buffers of the same format.
+GLenum bound_depth_format( GLint aFramebuffer );
+
+#endif // PARTICLE_OIT_HPP_7E1C4A93_0B5D_4D28_86F2_A93E5C1D7B40
@@ -0,0 +1,220 @@
+#include "particle_sort.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <cstring>
+
+namespace {
+constexpr unsigned kRadixBits_ = 11;
+constexpr unsigned kRadixPasses_ = 3; // covers the 32 key bits
+constexpr std::size_t kRadixBuckets_ = std::size_t(1) << kRadixBits_;
+
+// Below this, another thread costs more than it saves
+constexpr std::size_t kMinKeysPerThread_ = 32 * 1024;
+
+// Blocks until all of a fixed number of threads have arrived; reusable
+class Barrier_ {
+public:
+  explicit Barrier_(std::size_t aCount) : mCount(aCount) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    std::size_t const generation = mGeneration;
+    if (++mArrived == mCount) {
+      mArrived = 0;
+      ++mGeneration;
+      mCondition.notify_all();
+      return;
+    }
+
+    mCondition.wait(lock, [&] { return generation != mGeneration; });
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::size_t const mCount;
+  std::size_t mArrived = 0, mGeneration = 0;
+};
+} // namespace
+
+// Threads that wait for jobs from radix_sort_indices()
+class RadixSortWorkers {
+public:
+  RadixSortWorkers() = default;
+
+  ~RadixSortWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop = true;
+    }
+    mStart.notify_all();
+
+    for (auto &thread : mThreads)
+      thread.join();
+  }
+
+  RadixSortWorkers(RadixSortWorkers const &) = delete;
+  RadixSortWorkers &operator=(RadixSortWorkers const &) = delete;
+
+  // Run aJob(t) for t = 0..aCount-1 at the same time: t = 0 on the calling
+  // thread, the others on workers (started as needed). Returns when all
+  // have returned.
+  template <typename tJob> void run(std::size_t aCount, tJob &aJob) {
+    while (mThreads.size() + 1 < aCount) {
+      std::size_t const index = mThreads.size() + 1;
+      mThreads.emplace_back([this, index] { work_(index); });
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mJob = [](void *aContext, std::size_t aIndex) {
+        (*static_cast<tJob *>(aContext))(aIndex);
+      };
+      mContext = &aJob;
+      mActive = aCount;
+      mPending = aCount - 1;
+      ++mGeneration;
+    }
+    mStart.notify_all();
+
+    aJob(0);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [&] { return 0 == mPending; });
+  }
+
+private:
+  void work_(std::size_t aIndex) {
+    std::size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+      mStart.wait(lock, [&] { return mStop || seen != mGeneration; });
+      if (mStop)
+        return;
+
+      seen = mGeneration;
+      if (aIndex >= mActive)
+        continue;
+
+      auto const job = mJob;
+      void *const context = mContext;
+      lock.unlock();
+      job(context, aIndex);
+      lock.lock();
+
+      if (0 == --mPending)
+        mDone.notify_one();
+    }
+  }
+
+  std::vector<std::thread> mThreads; // worker t runs job t + 1
+  std::mutex mMutex;
+  std::condition_variable mStart, mDone;
+
+  void (*mJob)(void *, std::size_t) = nullptr;
+  void *mContext = nullptr;
+  std::size_t mActive = 0, mPending = 0, mGeneration = 0;
+  bool mStop = false;
+};
+
+RadixSortScratch::RadixSortScratch() = default;
+RadixSortScratch::~RadixSortScratch() = default;
+
+std::uint32_t float_sort_key(float aValue) noexcept {
+  std::uint32_t bits;
+  std::memcpy(&bits, &aValue, sizeof(bits));
+
+  // Negative values: flip all bits, so that larger magnitudes come first.
+  // Positive values: set the sign bit, so that they follow the negative ones.
+  return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+void radix_sort_indices(std::uint32_t const *aKeys, std::size_t aCount,
+                        std::uint32_t *aOrder, RadixSortScratch &aScratch,
+                        std::size_t aMaxThreads) {
+  auto &items = aScratch.items;
+  auto &temp = aScratch.temp;
+  items.resize(aCount);
+  temp.resize(aCount);
+
+  // The index in the low bits makes the sort's output directly usable
+  for (std::size_t i = 0; i < aCount; ++i)
+    items[i] = std::uint64_t(aKeys[i]) << 32 | i;
+
+  std::size_t const maxThreads =
+      aMaxThreads ? aMaxThreads
+                  : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t const threadCount =
+      std::clamp<std::size_t>(aCount / kMinKeysPerThread_, 1, maxThreads);
+
+  aScratch.counts.resize(threadCount * kRadixBuckets_);
+  aScratch.offsets.resize(threadCount * kRadixBuckets_);
+
+  Barrier_ barrier(threadCount);
+  std::uint64_t const *sorted = nullptr;
+
+  auto sort = [&](std::size_t aThread) {
+    std::size_t const begin = aCount * aThread / threadCount;
+    std::size_t const end = aCount * (aThread + 1) / threadCount;
+
+    std::size_t *const counts = &aScratch.counts[aThread * kRadixBuckets_];
+    std::size_t *const offsets = &aScratch.offsets[aThread * kRadixBuckets_];
+
+    std::uint64_t *src = items.data(), *dst = temp.data();
+    for (unsigned pass = 0; pass < kRadixPasses_; ++pass) {
+      unsigned const shift = 32 + pass * kRadixBits_;
+
+      std::fill(counts, counts + kRadixBuckets_, 0);
+      for (std::size_t i = begin; i < end; ++i)
+        ++counts[(src[i] >> shift) & (kRadixBuckets_ - 1)];
+
+      barrier.wait();
+
+      // This thread's part of each bucket follows all smaller buckets, and
+      // the same bucket's parts from earlier threads
+      std::size_t sum = 0;
+      bool skip = false;
+      for (std::size_t b = 0; b < kRadixBuckets_; ++b) {
+        std::size_t const bucketStart = sum;
+        for (std::size_t t = 0; t < threadCount; ++t) {
+          if (t == aThread)
+            offsets[b] = sum;
+          sum += aScratch.counts[t * kRadixBuckets_ + b];
+        }
+
+        // Depths within a narrow range often share their upper bits; the
+        // pass would not change anything then
+        skip = skip || aCount == sum - bucketStart;
+      }
+
+      if (!skip) {
+        for (std::size_t i = begin; i < end; ++i)
+          dst[offsets[(src[i] >> shift) & (kRadixBuckets_ - 1)]++] = src[i];
+      }
+
+      // All threads must be done with src and the counts
+      barrier.wait();
+      if (!skip)
+        std::swap(src, dst);
+    }
+
+    if (0 == aThread)
+      sorted = src;
+  };
+
+  if (1 == threadCount) {
+    sort(0);
+  } else {
+    if (!aScratch.workers)
+      aScratch.workers = std::make_unique<RadixSortWorkers>();
+    aScratch.workers->run(threadCount, sort);
+  }
+
+  for (std::size_t i = 0; i < aCount; ++i)
+    aOrder[i] = std::uint32_t(sorted[i]);
+}
@@ -0,0 +1,50 @@
+#ifndef PARTICLE_SORT_HPP_2D7A9E41_C6B3_4F08_9A15_E84F0C7B3D26
+#define PARTICLE_SORT_HPP_2D7A9E41_C6B3_4F08_9A15_E84F0C7B3D26
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/* Depth sorting of particles on the CPU
+ *
+ * Blended particles must be drawn back to front. Their view-space depths are
+ * converted to unsigned keys (float_sort_key()) and sorted with an LSD radix
+ * sort, three passes of 11 bits each. Large inputs are split among several
+ * threads: each thread counts and scatters its own part of the keys, so the
+ * sort stays stable. The threads are started by the first call that needs
+ * them and kept in the RadixSortScratch, waiting for the next sort.
+ *
+ * The GPU simulation sorts with a compute shader instead (see
+ * assets/particle_sort.comp), using the same keys.
+ */
+
+// Unsigned integer that orders like aValue (negative values included)
+std::uint32_t float_sort_key( float aValue ) noexcept;
+
+class RadixSortWorkers;
+
+// Buffers and worker threads reused between calls of radix_sort_indices()
+struct RadixSortScratch
+{
+	RadixSortScratch();
+	~RadixSortScratch(); // joins the workers
+
+	std::vector<std::uint64_t> items, temp; // key << 32 | index
+	std::vector<std::size_t> counts, offsets; // per thread and bucket
+	std::unique_ptr<RadixSortWorkers> workers;
+};
+
+// Write to aOrder the indices 0..aCount-1, ordered by increasing aKeys[i].
+// Equal keys keep their order. aMaxThreads = 0 uses all hardware threads,
+// but small inputs are always sorted on the calling thread.
+void radix_sort_indices(
+	std::uint32_t const* aKeys,
+	std::size_t aCount,
+	std::uint32_t* aOrder,
+	RadixSortScratch&,
+	std::size_t aMaxThreads = 0
+);
+
+#endif // PARTICLE_SORT_HPP_2D7A9E41_C6B3_4F08_9A15_E84F0C7B3D26
@@ -0,0 +1,182 @@
+#include "particle_store.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+std::size_t padded_(std::size_t aCount) {
+  return (aCount + kParticleSimdWidth - 1) / kParticleSimdWidth *
+         kParticleSimdWidth;
+}
+
+void update_scalar_(ParticleStore &aStore, std::size_t aCount,
+                    float aDeltaTime) {
+  for (std::size_t i = 0; i < aCount; ++i) {
+    if (0.f == aStore.active[i])
+      continue;
+
+    if (aStore.lifeRemaining[i] <= 0.f) {
+      aStore.active[i] = 0.f;
+      continue;
+    }
+
+    aStore.lifeRemaining[i] -= aDeltaTime;
+    aStore.positionX[i] += aStore.velocityX[i] * aDeltaTime;
+    aStore.positionY[i] += aStore.velocityY[i] * aDeltaTime;
+    aStore.positionZ[i] += aStore.velocityZ[i] * aDeltaTime;
+    aStore.rotation[i] += 0.01f * aDeltaTime;
+  }
+}
+
+// The SIMD kernels avoid branches: the time step is masked to zero for
+// particles that are inactive or that are being deactivated, so that all
+// particles can be integrated unconditionally.
+#if defined(__AVX2__)
+void update_simd_(ParticleStore &aStore, std::size_t aCount,
+                  float aDeltaTime) {
+  __m256 const dt = _mm256_set1_ps(aDeltaTime);
+  __m256 const spin = _mm256_set1_ps(0.01f * aDeltaTime);
+  __m256 const zero = _mm256_setzero_ps();
+  __m256 const one = _mm256_set1_ps(1.f);
+
+  // The padding guarantees that whole vectors are in bounds
+  for (std::size_t i = 0; i < aCount; i += 8) {
+    __m256 const active = _mm256_load_ps(&aStore.active[i]);
+    __m256 const life = _mm256_load_ps(&aStore.lifeRemaining[i]);
+
+    __m256 const live = _mm256_and_ps(_mm256_cmp_ps(active, zero, _CMP_NEQ_OQ),
+                                      _mm256_cmp_ps(life, zero, _CMP_GT_OQ));
+    __m256 const step = _mm256_and_ps(live, dt);
+
+    _mm256_store_ps(&aStore.active[i], _mm256_and_ps(live, one));
+    _mm256_store_ps(&aStore.lifeRemaining[i], _mm256_sub_ps(life, step));
+
+    float *const pos[3] = {&aStore.positionX[i], &aStore.positionY[i],
+                           &aStore.positionZ[i]};
+    float const *const vel[3] = {&aStore.velocityX[i], &aStore.velocityY[i],
+                                 &aStore.velocityZ[i]};
+    for (int k = 0; k < 3; ++k) {
+      __m256 const v = _mm256_mul_ps(_mm256_load_ps(vel[k]), step);
+      _mm256_store_ps(pos[k], _mm256_add_ps(_mm256_load_ps(pos[k]), v));
+    }
+
+    __m256 const rot = _mm256_load_ps(&aStore.rotation[i]);
+    _mm256_store_ps(&aStore.rotation[i],
+                    _mm256_add_ps(rot, _mm256_and_ps(live, spin)));
+  }
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+void update_simd_(ParticleStore &aStore, std::size_t aCount,
+                  float aDeltaTime) {
+  __m128 const dt = _mm_set1_ps(aDeltaTime);
+  __m128 const spin = _mm_set1_ps(0.01f * aDeltaTime);
+  __m128 const zero = _mm_setzero_ps();
+  __m128 const one = _mm_set1_ps(1.f);
+
+  for (std::size_t i = 0; i < aCount; i += 4) {
+    __m128 const active = _mm_load_ps(&aStore.active[i]);
+    __m128 const life = _mm_load_ps(&aStore.lifeRemaining[i]);
+
+    __m128 const live =
+        _mm_and_ps(_mm_cmpneq_ps(active, zero), _mm_cmpgt_ps(life, zero));
+    __m128 const step = _mm_and_ps(live, dt);
+
+    _mm_store_ps(&aStore.active[i], _mm_and_ps(live, one));
+    _mm_store_ps(&aStore.lifeRemaining[i], _mm_sub_ps(life, step));
+
+    float *const pos[3] = {&aStore.positionX[i], &aStore.positionY[i],
+                           &aStore.positionZ[i]};
+    float const *const vel[3] = {&aStore.velocityX[i], &aStore.velocityY[i],
+                                 &aStore.velocityZ[i]};
+    for (int k = 0; k < 3; ++k) {
+      __m128 const v = _mm_mul_ps(_mm_load_ps(vel[k]), step);
+      _mm_store_ps(pos[k], _mm_add_ps(_mm_load_ps(pos[k]), v));
+    }
+
+    __m128 const rot = _mm_load_ps(&aStore.rotation[i]);
+    _mm_store_ps(&aStore.rotation[i], _mm_add_ps(rot, _mm_and_ps(live, spin)));
+  }
+}
+#else
+void update_simd_(ParticleStore &aStore, std::size_t aCount,
+                  float aDeltaTime) {
+  update_scalar_(aStore, aCount, aDeltaTime);
+}
+#endif
+} // namespace
+
+ParticleStore::ParticleStore(std::size_t aCapacity) { resize(aCapacity); }
+
+void ParticleStore::resize(std::size_t aCapacity) {
+  std::size_t const n = padded_(aCapacity);
+
+  for (auto *arr : {&positionX, &positionY, &positionZ, &velocityX, &velocityY,
+                    &velocityZ, &rotation, &lifeRemaining, &active, &lifeTime,
+                    &sizeBegin, &sizeEnd})
+    arr->resize(n, 0.f);
+
+  colorBegin.resize(n, Vec4f{0.f, 0.f, 0.f, 0.f});
+  colorEnd.resize(n, Vec4f{0.f, 0.f, 0.f, 0.f});
+  serial.resize(n, 0);
+  emitter.resize(n, 0);
+
+  // Particles that were cut off are gone; the padding must be inactive
+  std::fill(active.begin() + std::min(aCapacity, n), active.end(), 0.f);
+}
+
+void ParticleStore::move(std::size_t aFrom, std::size_t aTo) noexcept {
+  for (auto *arr : {&positionX, &positionY, &positionZ, &velocityX, &velocityY,
+                    &velocityZ, &rotation, &lifeRemaining, &active, &lifeTime,
+                    &sizeBegin, &sizeEnd})
+    (*arr)[aTo] = (*arr)[aFrom];
+
+  colorBegin[aTo] = colorBegin[aFrom];
+  colorEnd[aTo] = colorEnd[aFrom];
+  serial[aTo] = serial[aFrom];
+  emitter[aTo] = emitter[aFrom];
+}
+
+void update_particles(ParticleStore &aStore, std::size_t aCount,
+                      float aDeltaTime, ParticleKernel aKernel) {
+  assert(aCount <= aStore.capacity());
+
+  if (ParticleKernel::simd == aKernel)
+    update_simd_(aStore, aCount, aDeltaTime);
+  else
+    update_scalar_(aStore, aCount, aDeltaTime);
+}
+
+std::size_t remove_dead_particles(ParticleStore &aStore, std::size_t aCount) {
+  assert(aCount <= aStore.capacity());
+
+  for (std::size_t i = 0; i < aCount;) {
+    if (0.f != aStore.active[i]) {
+      ++i;
+      continue;
+    }
+
+    // The moved particle is checked in the next iteration
+    --aCount;
+    if (i != aCount) {
+      aStore.move(aCount, i);
+      aStore.active[aCount] = 0.f;
+    }
+  }
+
+  return aCount;
+}
+
+char const *particle_simd_name() noexcept {
+#if defined(__AVX2__)
+  return "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+  return "SSE2";
+#else
+  return "none";
+#endif
+}
@@ -0,0 +1,112 @@
+#ifndef PARTICLE_STORE_HPP_5B8E2C1A_94D7_4F36_A0C2_E71D3B6F8A45
+#define PARTICLE_STORE_HPP_5B8E2C1A_94D7_4F36_A0C2_E71D3B6F8A45
+
+#include <new>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../vmlib/vec4.hpp"
+
+/* Structure-of-arrays particle storage
+ *
+ * Each particle attribute is stored in its own array, so that the update
+ * (which only touches positions, velocities, rotations and life times) reads
+ * densely packed data, and processes several particles per SIMD instruction.
+ * The arrays are aligned to kParticleAlignment bytes, and padded to a
+ * multiple of kParticleSimdWidth; padding slots are inactive.
+ *
+ * Live particles are kept densely packed at the start of the store (see
+ * remove_dead_particles()), so that the cost of updating and drawing them
+ * does not depend on the capacity. Slots after the live ones are inactive.
+ */
+
+constexpr std::size_t kParticleAlignment = 32;
+
+// Particles processed per iteration by ParticleKernel::simd
+#if defined(__AVX2__)
+constexpr std::size_t kParticleSimdWidth = 8;
+#elif defined(__SSE2__) || defined(_M_X64)
+constexpr std::size_t kParticleSimdWidth = 4;
+#else
+constexpr std::size_t kParticleSimdWidth = 1;
+#endif
+
+template< typename tType >
+struct ParticleAllocator
+{
+	using value_type = tType;
+
+	ParticleAllocator() noexcept = default;
+	template< typename tOther >
+	ParticleAllocator( ParticleAllocator<tOther> const& ) noexcept {}
+
+	tType* allocate( std::size_t aCount )
+	{
+		return static_cast<tType*>( ::operator new( aCount * sizeof(tType), std::align_val_t(kParticleAlignment) ) );
+	}
+	void deallocate( tType* aPtr, std::size_t ) noexcept
+	{
+		::operator delete( aPtr, std::align_val_t(kParticleAlignment) );
+	}
+
+	template< typename tOther >
+	bool operator== ( ParticleAllocator<tOther> const& ) const noexcept { return true; }
+	template< typename tOther >
+	bool operator!= ( ParticleAllocator<tOther> const& ) const noexcept { return false; }
+};
+
+using ParticleFloats = std::vector<float,ParticleAllocator<float>>;
+
+struct ParticleStore
+{
+	explicit ParticleStore( std::size_t aCapacity = 0 );
+
+	std::size_t capacity() const noexcept { return active.size(); }
+
+	// Keeps the first min(capacity(), aCapacity) particles
+	void resize( std::size_t aCapacity );
+
+	// Copy all attributes of particle aFrom to slot aTo
+	void move( std::size_t aFrom, std::size_t aTo ) noexcept;
+
+	// Hot data, read and written by update_particles()
+	ParticleFloats positionX, positionY, positionZ;
+	ParticleFloats velocityX, velocityY, velocityZ;
+	ParticleFloats rotation;
+	ParticleFloats lifeRemaining;
+	ParticleFloats active; // 1 or 0
+
+	// Cold data, only needed for drawing
+	ParticleFloats lifeTime;
+	ParticleFloats sizeBegin, sizeEnd;
+	std::vector<Vec4f> colorBegin, colorEnd;
+
+	// Sequence number of the spawn that created the particle
+	std::vector<std::uint64_t> serial;
+
+	// Emitter that spawned the particle (see ParticleEmitterParams)
+	std::vector<std::uint32_t> emitter;
+};
+
+enum class ParticleKernel
+{
+	scalar,
+	simd // kParticleSimdWidth particles at a time (AVX2, SSE2)
+};
+
+// Age and move the active particles among the first aCount. Particles whose
+// life has run out are deactivated (one step later, as they are still drawn
+// with zero life).
+void update_particles( ParticleStore&, std::size_t aCount, float aDeltaTime, ParticleKernel = ParticleKernel::simd );
+
+// Remove the inactive particles among the first aCount, by moving the last
+// live particle into their slot. Returns the number of live particles, which
+// are then the first ones in the store.
+std::size_t remove_dead_particles( ParticleStore&, std::size_t aCount );
+
+// Instruction set used by ParticleKernel::simd
+char const* particle_simd_name() noexcept;
+
+#endif // PARTICLE_STORE_HPP_5B8E2C1A_94D7_4F36_A0C2_E71D3B6F8A45
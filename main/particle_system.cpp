@@ -1,12 +1,10 @@
 #include "particle_system.hpp"
 
-// Generate random float between 0 and 1
-float RandomFloat01() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-    return dis(gen);
-}
+#include <algorithm>
+#include <iterator>
+
+#include <cmath>
+#include <cstddef>
 
 // Linear interpolation function betwen two floats
 float lerp(float a, float b, float f)
@@ -24,86 +22,392 @@ Vec4f lerp(const Vec4f& a, const Vec4f& b, float t) {
     return result;
 }
 
-// Constructor sets ParticlePool vector to size 1000
-ParticleSystem::ParticleSystem()
+// Constructor sets the particle store to size poolSize
+ParticleSystem::ParticleSystem(std::size_t poolSize, ParticleSimulation simulation, ParticleOverflow overflow, ParticleShape shape)
+	: simulation(simulation)
+	, overflow(overflow)
+	, shape(shape)
+	, poolSize(poolSize)
+	, shapeIndexCount(ParticleShape::billboard == shape ? 6 : 36)
+{
+	char const* fragmentShader = "assets/particle.frag";
+	if (ParticleShape::billboard == shape)
+	{
+		particleTexture = CreateSpriteTexture();
+		fragmentShader = "assets/particle_billboard.frag";
+	}
+
+	if (ParticleSimulation::gpu == simulation)
+	{
+		CreateGpuBuffers();
+
+		vertexShader = "assets/particle_gpu.vert";
+		updateProgram = &get_program({{GL_COMPUTE_SHADER, "assets/particle_update.comp"}});
+		emitProgram = &get_program({{GL_COMPUTE_SHADER, "assets/particle_emit.comp"}});
+		sortProgram = &get_program({{GL_COMPUTE_SHADER, "assets/particle_sort.comp"}});
+	}
+	else if (ParticleSimulation::analytic == simulation)
+	{
+		vertexShader = "assets/particle_analytic.vert";
+	}
+	else
+	{
+		particles = ParticleStore(poolSize);
+		instances.reserve(poolSize);
+	}
+
+	// Shared program, compiled on first use only
+	particleProgram = &get_program({{GL_VERTEX_SHADER, vertexShader},
+	                                {GL_FRAGMENT_SHADER, fragmentShader}});
+}
+
+ParticleSystem::~ParticleSystem()
+{
+	GLuint const buffers[] = { shapeVB, shapeIB, instanceVB, emitterSB, particleSB, freeListSB, aliveListSB, spawnSB, drawCommandB, sortSB };
+	glDeleteBuffers(GLsizei(std::size(buffers)), buffers);
+	glDeleteVertexArrays(1, &shapeVA);
+	glDeleteTextures(1, &particleTexture);
+}
+
+// Alpha mask of the billboards: white, with an alpha that falls off smoothly
+// from 1 at the center to 0 at the inscribed circle. Generated rather than
+// loaded; assets/particle.png is a hard-edged frame, not a sprite.
+GLuint ParticleSystem::CreateSpriteTexture()
+{
+	constexpr int kSize = 64;
+
+	std::vector<unsigned char> pixels(kSize * kSize * 4, 255);
+	for (int y = 0; y < kSize; ++y)
+	{
+		for (int x = 0; x < kSize; ++x)
+		{
+			float const dx = (x + 0.5f) / kSize * 2.0f - 1.0f;
+			float const dy = (y + 0.5f) / kSize * 2.0f - 1.0f;
+			float const falloff = std::max(0.0f, 1.0f - (dx * dx + dy * dy));
+			pixels[(y * kSize + x) * 4 + 3] = (unsigned char)(falloff * falloff * 255.0f + 0.5f);
+		}
+	}
+
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, kSize, kSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// Buffers of the gpu simulation. All slots start out on the free list.
+void ParticleSystem::CreateGpuBuffers()
 {
-	particlePool.resize(1000);
+	glGenBuffers(1, &particleSB);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSB);
+	std::vector<GpuParticle> const dead(poolSize, GpuParticle{});
+	glBufferData(GL_SHADER_STORAGE_BUFFER, poolSize * sizeof(GpuParticle), dead.data(), GL_DYNAMIC_DRAW);
+
+	// { int freeCount; uint freeIndices[poolSize]; }, popped from the end so
+	// that slot 0 is used first
+	std::vector<uint32_t> freeList(poolSize + 1);
+	freeList[0] = uint32_t(poolSize);
+	for (std::size_t i = 0; i < poolSize; ++i)
+		freeList[1 + i] = uint32_t(poolSize - 1 - i);
+
+	glGenBuffers(1, &freeListSB);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, freeListSB);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, freeList.size() * sizeof(uint32_t), freeList.data(), GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &aliveListSB);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, aliveListSB);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, poolSize * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+
+	// count, instanceCount, firstIndex, baseVertex, baseInstance
+	GLuint const command[5] = { GLuint(shapeIndexCount), 0, 0, 0, 0 };
+	glGenBuffers(1, &drawCommandB);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandB);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(command), command, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &spawnSB);
+
+	// Whole blocks of particle_sort.comp
+	sortSize = 512;
+	while (sortSize < poolSize)
+		sortSize *= 2;
+
+	glGenBuffers(1, &sortSB);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortSB);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sortSize * 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 // Update particles function
 void ParticleSystem::Update(float ts)
 {
-	for (auto& particle : particlePool)
+	drawPrepared = false;
+
+	if (ParticleSimulation::gpu == simulation)
+	{
+		// The update pass lists the particles to draw from scratch. The
+		// previous passes incremented instanceCount in shaders, and a
+		// buffer update is only ordered after those writes by a barrier.
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		GLuint const zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandB);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), sizeof(GLuint), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSB);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, freeListSB);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, aliveListSB);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, drawCommandB);
+
+		glUseProgram(updateProgram->programId());
+		glUniform1f(0, ts);
+		glUniform1ui(1, GLuint(poolSize));
+		glDispatchCompute(GLuint((poolSize + 255) / 256), 1, 1);
+		return;
+	}
+
+	if (ParticleSimulation::analytic == simulation)
 	{
-		if (!particle.Active)
-			continue;
+		time += ts;
 
-		if (particle.LifeRemaining <= 0.0f)
+		std::uint32_t const current = epoch % 2, other = 1 - current;
+		if (time - epochStart[current] >= kEpochLength && time >= epochEnd[other])
 		{
-			particle.Active = false;
-			continue;
+			++epoch;
+			epochStart[other] = epochEnd[other] = time;
 		}
+		return;
+	}
+
+	update_particles(particles, aliveCount, ts);
+	aliveCount = remove_dead_particles(particles, aliveCount);
+}
+
+// Emit the particles spawned since the last call (gpu only)
+void ParticleSystem::EmitGpu()
+{
+	if (pendingSpawns.empty())
+		return;
+
+	if (pendingSpawns.size() > spawnCapacity)
+		spawnCapacity = std::max(pendingSpawns.size(), 2 * spawnCapacity);
 
-		particle.LifeRemaining -= ts;
-		particle.Position += particle.Velocity * (float)ts;
-		particle.Rotation += 0.01f * ts;
+	// Orphan the previous upload, as for the instance buffer
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, spawnSB);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, spawnCapacity * sizeof(GpuParticle), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, pendingSpawns.size() * sizeof(GpuParticle), pendingSpawns.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, freeListSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, aliveListSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, drawCommandB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, spawnSB);
+
+	// The update pass returns slots to the free list
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(emitProgram->programId());
+	glUniform1ui(0, GLuint(pendingSpawns.size()));
+	glDispatchCompute(GLuint((pendingSpawns.size() + 255) / 256), 1, 1);
+
+	pendingSpawns.clear();
+}
+
+// Write the particles spawned since the last call to their ring slots
+// (analytic only)
+void ParticleSystem::UploadAnalytic()
+{
+	std::size_t const count = pendingAnalytic.size();
+
+	// Particles that were replaced within the same frame are skipped
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVB);
+	for (std::size_t i = count > poolSize ? count - poolSize : 0; i < count;)
+	{
+		std::size_t const slot = std::size_t((pendingFirst + i) % poolSize);
+		std::size_t const run = std::min(count - i, poolSize - slot);
+		glBufferSubData(GL_ARRAY_BUFFER, slot * sizeof(AnalyticParticle), run * sizeof(AnalyticParticle), &pendingAnalytic[i]);
+		i += run;
 	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	pendingAnalytic.clear();
+}
+
+// Sort the alive list back to front (gpu only). The number of live
+// particles is only known to the GPU, so the whole padded pool is sorted;
+// slots after the live particles sort last.
+void ParticleSystem::SortGpu(const Mat44f& cameraWorld)
+{
+	constexpr GLuint kBlock = 512; // see particle_sort.comp
+	GLuint const size = GLuint(sortSize);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, aliveListSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, drawCommandB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, sortSB);
+
+	glUseProgram(sortProgram->programId());
+	glUniform1ui(3, size);
+	glUniform4f(4, cameraWorld(2, 0), cameraWorld(2, 1), cameraWorld(2, 2), cameraWorld(2, 3));
+
+	auto const stage = [](GLuint stage, GLuint groups, GLuint k = 0, GLuint j = 0)
+	{
+		glUniform1ui(0, stage);
+		glUniform1ui(1, k);
+		glUniform1ui(2, j);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	};
+
+	stage(0, size / 256);
+	stage(1, size / kBlock);
+	for (GLuint k = 2 * kBlock; k <= size; k *= 2)
+	{
+		for (GLuint j = k / 2; j >= kBlock; j /= 2)
+			stage(2, size / 2 / 256, k, j);
+		stage(3, size / kBlock, k);
+	}
+	stage(4, size / 256);
+}
+
+// Uniforms and texture shared by the particle vertex shaders. Billboards
+// are spanned by the camera's right and up axes, which are the first two
+// rows of cameraWorld.
+void ParticleSystem::SetShapeUniforms(const Mat44f& cameraWorld)
+{
+	if (ParticleShape::billboard != shape)
+	{
+		glUniform1i(2, GL_FALSE);
+		return;
+	}
+
+	Vec3f const right = normalize(Vec3f{cameraWorld(0, 0), cameraWorld(0, 1), cameraWorld(0, 2)});
+	Vec3f const up = normalize(Vec3f{cameraWorld(1, 0), cameraWorld(1, 1), cameraWorld(1, 2)});
+
+	glUniform1i(2, GL_TRUE);
+	glUniform3fv(3, 1, &right.x);
+	glUniform3fv(4, 1, &up.x);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, particleTexture);
+}
+
+// Per-emitter draw settings, read by the vertex shaders from binding 6
+void ParticleSystem::BindEmitterParams()
+{
+	if (!emitterSB)
+		glGenBuffers(1, &emitterSB);
+
+	if (emitterParamsChanged)
+	{
+		// The buffer is only reallocated when emitters were added
+		GLsizeiptr const bytes = GLsizeiptr(emitterParams.size() * sizeof(ParticleEmitterParams));
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterSB);
+		if (emitterParams.size() != emitterSBCount)
+		{
+			glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, emitterParams.data(), GL_DYNAMIC_DRAW);
+			emitterSBCount = emitterParams.size();
+		}
+		else
+		{
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, emitterParams.data());
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		emitterParamsChanged = false;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, emitterSB);
 }
 
 // Render particles
-void ParticleSystem::Render(Mat44f projCameraWorld)
+void ParticleSystem::Render(Mat44f projCameraWorld, Mat44f cameraWorld)
+{
+	RenderEmitters(projCameraWorld, cameraWorld, -1);
+}
+
+void ParticleSystem::Render(Mat44f projCameraWorld, Mat44f cameraWorld, ParticleResolution resolution)
 {
-    ShaderProgram prog({{GL_VERTEX_SHADER, "assets/particle.vert"},
-                        {GL_FRAGMENT_SHADER, "assets/particle.frag"}});
+	RenderEmitters(projCameraWorld, cameraWorld, GLint(resolution));
+}
 
+bool ParticleSystem::UsesResolution(ParticleResolution resolution) const
+{
+	return std::any_of(emitterParams.begin(), emitterParams.end(), [&](const ParticleEmitterParams& params)
+	{
+		return resolution == params.Resolution;
+	});
+}
 
-    if (!cubeVA)
+// Draw the particles of the emitters drawn at resolution, or of all emitters
+// if it is -1 (see the vertex shaders' uResolution)
+void ParticleSystem::RenderEmitters(const Mat44f& projCameraWorld, const Mat44f& cameraWorld, GLint resolution)
+{
+    if (!shapeVA)
     {
+        float const h = 0.5f * kParticleShapeSize; // half the edge
         float vertices[] = {
             // Front face
-            -0.05f, -0.05f, 0.05f,
-            0.05f, -0.05f, 0.05f,
-            0.05f,  0.05f, 0.05f,
-            -0.05f,  0.05f, 0.05f,
+            -h, -h, h,
+            h, -h, h,
+            h,  h, h,
+            -h,  h, h,
 
             // Back face
-            -0.05f, -0.05f, -0.05f,
-            0.05f, -0.05f, -0.05f,
-            0.05f,  0.05f, -0.05f,
-            -0.05f,  0.05f, -0.05f,
+            -h, -h, -h,
+            h, -h, -h,
+            h,  h, -h,
+            -h,  h, -h,
 
             // Left face
-            -0.05f, -0.05f, -0.05f,
-            -0.05f, -0.05f,  0.05f,
-            -0.05f,  0.05f,  0.05f,
-            -0.05f,  0.05f, -0.05f,
+            -h, -h, -h,
+            -h, -h,  h,
+            -h,  h,  h,
+            -h,  h, -h,
 
             // Right face
-            0.05f, -0.05f, -0.05f,
-            0.05f, -0.05f,  0.05f,
-            0.05f,  0.05f,  0.05f,
-            0.05f,  0.05f, -0.05f,
+            h, -h, -h,
+            h, -h,  h,
+            h,  h,  h,
+            h,  h, -h,
 
             // Top face
-            -0.05f,  0.05f,  0.05f,
-            0.05f,  0.05f,  0.05f,
-            0.05f,  0.05f, -0.05f,
-            -0.05f,  0.05f, -0.05f,
+            -h,  h,  h,
+            h,  h,  h,
+            h,  h, -h,
+            -h,  h, -h,
 
             // Bottom face
-            -0.05f, -0.05f,  0.05f,
-            0.05f, -0.05f,  0.05f,
-            0.05f, -0.05f, -0.05f,
-            -0.05f, -0.05f, -0.05f
+            -h, -h,  h,
+            h, -h,  h,
+            h, -h, -h,
+            -h, -h, -h
         };
 
-        glGenVertexArrays(1, &cubeVA);
-        glBindVertexArray(cubeVA);
+        glGenVertexArrays(1, &shapeVA);
+        glBindVertexArray(shapeVA);
+
+        glGenBuffers(1, &shapeVB);
+        glBindBuffer(GL_ARRAY_BUFFER, shapeVB);
+        // Billboards are a single quad, facing the camera (see
+        // SetShapeUniforms()), with the same extent as the cube
+        float const quadVertices[] = {
+            -h, -h, 0.0f,
+            h, -h, 0.0f,
+            h,  h, 0.0f,
+            -h,  h, 0.0f
+        };
 
-        GLuint cubeVB, cubeIB;
-        glGenBuffers(1, &cubeVB);
-        glBindBuffer(GL_ARRAY_BUFFER, cubeVB);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        bool const billboard = ParticleShape::billboard == shape;
+        glBufferData(GL_ARRAY_BUFFER, billboard ? sizeof(quadVertices) : sizeof(vertices), billboard ? quadVertices : vertices, GL_STATIC_DRAW);
 
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
@@ -117,61 +421,215 @@ void ParticleSystem::Render(Mat44f projCameraWorld)
             20, 21, 22, 22, 23, 20
         };
 
-        glGenBuffers(1, &cubeIB);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIB);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glGenBuffers(1, &shapeIB);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shapeIB);
+        // Only the first face is used by billboards
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(shapeIndexCount * sizeof(uint32_t)), indices, GL_STATIC_DRAW);
+
+        // Per-instance attributes go to their own binding point (0 is used
+        // by the shape's positions), and advance once per particle. Particles
+        // simulated on the gpu are read from their storage buffer instead.
+        if (ParticleSimulation::cpu == simulation)
+        {
+            glGenBuffers(1, &instanceVB);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVB);
+            glBufferData(GL_ARRAY_BUFFER, poolSize * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+
+            GLuint const binding = 1;
+            glVertexAttribFormat(1, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(Instance, CenterSize)));
+            glVertexAttribFormat(2, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(Instance, Color)));
+            glVertexAttribFormat(3, 1, GL_FLOAT, GL_FALSE, GLuint(offsetof(Instance, Rotation)));
+            glVertexAttribIFormat(4, 1, GL_UNSIGNED_INT, GLuint(offsetof(Instance, Emitter)));
+            for (GLuint attrib = 1; attrib <= 4; ++attrib)
+            {
+                glVertexAttribBinding(attrib, binding);
+                glEnableVertexAttribArray(attrib);
+            }
+
+            glBindVertexBuffer(binding, instanceVB, 0, sizeof(Instance));
+            glVertexBindingDivisor(binding, 1);
+        }
+        else if (ParticleSimulation::analytic == simulation)
+        {
+            // Written once per particle, by UploadAnalytic()
+            glGenBuffers(1, &instanceVB);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVB);
+            glBufferData(GL_ARRAY_BUFFER, poolSize * sizeof(AnalyticParticle), nullptr, GL_DYNAMIC_DRAW);
+
+            GLuint const binding = 1;
+            glVertexAttribFormat(1, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, PositionSpawn)));
+            glVertexAttribFormat(2, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, PositionVariationLife)));
+            glVertexAttribFormat(3, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, VelocitySizeBegin)));
+            glVertexAttribFormat(4, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, VelocityVariationSizeEnd)));
+            glVertexAttribFormat(5, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, ColorBegin)));
+            glVertexAttribFormat(6, 4, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, ColorEnd)));
+            glVertexAttribFormat(7, 1, GL_FLOAT, GL_FALSE, GLuint(offsetof(AnalyticParticle, SizeVariation)));
+            glVertexAttribIFormat(8, 1, GL_UNSIGNED_INT, GLuint(offsetof(AnalyticParticle, Seed)));
+            glVertexAttribIFormat(9, 1, GL_UNSIGNED_INT, GLuint(offsetof(AnalyticParticle, Emitter)));
+            glVertexAttribIFormat(10, 1, GL_UNSIGNED_INT, GLuint(offsetof(AnalyticParticle, Epoch)));
+            for (GLuint attrib = 1; attrib <= 10; ++attrib)
+            {
+                glVertexAttribBinding(attrib, binding);
+                glEnableVertexAttribArray(attrib);
+            }
+
+            glBindVertexBuffer(binding, instanceVB, 0, sizeof(AnalyticParticle));
+            glVertexBindingDivisor(binding, 1);
+        }
+
+        glBindVertexArray(0);
     }
 
-	glUseProgram(prog.programId());
-	glUniformMatrix4fv(0, 1, GL_TRUE, projCameraWorld.v);
+	bool const sameCamera = std::equal(std::begin(cameraWorld.v), std::end(cameraWorld.v), std::begin(preparedCameraWorld.v));
+	if (!drawPrepared || !sameCamera)
+		PrepareDraw(cameraWorld);
 
-	for (auto& particle : particlePool)
+	std::size_t drawn = 0; // instances, cpu and analytic
+	if (ParticleSimulation::analytic == simulation)
+	{
+		// Slots that were never written are not drawn; dead particles are
+		// culled by the vertex shader
+		drawn = std::size_t(std::min<std::uint64_t>(spawnCount, poolSize));
+	}
+	else if (ParticleSimulation::cpu == simulation)
 	{
-		if (!particle.Active)
-			continue;
+		drawn = instances.size();
+	}
 
-		// Fade away particles
-		float life = particle.LifeRemaining / particle.LifeTime;
-		float size = lerp(particle.SizeEnd, particle.SizeBegin, life);
-        Vec4f color = lerp(particle.ColorEnd, particle.ColorBegin, life);
-		
-		// Render
-        Mat44f transform = make_translation(Vec3f{particle.Position.x, particle.Position.y, particle.Position.z})
-            * make_rotation_x(particle.Rotation)
-            * make_rotation_y(particle.Rotation)
-            * make_rotation_z(particle.Rotation)
-            * make_scaling(size, size, size);
+	if (ParticleSimulation::gpu != simulation && 0 == drawn)
+		return;
+
+	glUseProgram(DrawProgram().programId());
+	glUniformMatrix4fv(0, 1, GL_TRUE, projCameraWorld.v);
+	glUniform1i(6, resolution);
+	SetShapeUniforms(cameraWorld);
+	BindEmitterParams();
+
+	if (ParticleSimulation::gpu == simulation)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleSB);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, aliveListSB);
+
+		glBindVertexArray(shapeVA);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandB);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+		return;
+	}
 
-		glUniformMatrix4fv(1, 1, GL_TRUE, transform.v);
-		glUniform4f(2,color.x, color.y, color.z, color.w);
-		glBindVertexArray(cubeVA);
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr);
+	if (ParticleSimulation::analytic == simulation)
+	{
+		// Time since each current epoch, and which epochs are current
+		std::uint32_t const current = epoch % 2, other = 1 - current;
+		std::uint32_t epochs[2];
+		epochs[current] = epoch;
+		epochs[other] = epoch - 1; // never matches before the first switch
+		glUniform2f(1, float(time - epochStart[0]), float(time - epochStart[1]));
+		glUniform2ui(5, epochs[0], epochs[1]);
 	}
+
+	glBindVertexArray(shapeVA);
+	glDrawElementsInstanced(GL_TRIANGLES, shapeIndexCount, GL_UNSIGNED_INT, nullptr, GLsizei(drawn));
+	glBindVertexArray(0);
 }
 
-// Spawn particles
-void ParticleSystem::Spawn(const ParticleInit& particleInit)
-{   
-    // Get current index of particle pool
-	Particle& particle = particlePool[poolIndex];
+// Work shared by all passes that draw the same particles from the same
+// camera: emitting and sorting (gpu), uploading the new particles
+// (analytic), or sorting and uploading the live particles (cpu)
+void ParticleSystem::PrepareDraw(const Mat44f& cameraWorld)
+{
+	drawPrepared = true;
+	preparedCameraWorld = cameraWorld;
 
-    // Set particle to active
-	particle.Active = true;
+	if (ParticleSimulation::gpu == simulation)
+	{
+		EmitGpu();
+
+		// Wait for the particles and the draw command written by the
+		// compute passes
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+		if (SortsBackToFront())
+			SortGpu(cameraWorld);
+		return;
+	}
+
+	if (ParticleSimulation::analytic == simulation)
+	{
+		UploadAnalytic();
+		return;
+	}
+
+	// Indices of the particles to draw, in order
+	sortOrder.resize(aliveCount);
+	if (SortsBackToFront())
+	{
+		// The camera looks down -z, so the farthest particles have the
+		// smallest view-space z
+		sortKeys.resize(aliveCount);
+		for (std::size_t i = 0; i < aliveCount; ++i)
+		{
+			float const z = cameraWorld(2, 0) * particles.positionX[i] + cameraWorld(2, 1) * particles.positionY[i]
+				+ cameraWorld(2, 2) * particles.positionZ[i] + cameraWorld(2, 3);
+			sortKeys[i] = float_sort_key(z);
+		}
+
+		radix_sort_indices(sortKeys.data(), aliveCount, sortOrder.data(), sortScratch);
+	}
+	else
+	{
+		for (std::size_t i = 0; i < aliveCount; ++i)
+			sortOrder[i] = std::uint32_t(i);
+	}
+
+	instances.clear();
+	for (std::uint32_t i : sortOrder)
+	{
+		// Fade away particles
+		float life = particles.lifeRemaining[i] / particles.lifeTime[i];
+		float size = lerp(particles.sizeEnd[i], particles.sizeBegin[i], life);
+        Vec4f color = lerp(particles.colorEnd[i], particles.colorBegin[i], life);
+
+		instances.push_back({
+			Vec4f{particles.positionX[i], particles.positionY[i], particles.positionZ[i], size},
+			color,
+			particles.rotation[i],
+			particles.emitter[i]
+		});
+	}
+
+	if (instances.empty())
+		return;
+
+	// Orphan the previous frame's data, so the upload does not wait for the
+	// GPU to finish drawing it
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVB);
+	glBufferData(GL_ARRAY_BUFFER, poolSize * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Instance), instances.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Make a particle from its emitter's settings and kSpawnRandoms random
+// numbers in [0, 1)
+ParticleSystem::Particle ParticleSystem::MakeParticle(const ParticleInit& particleInit, const float* r)
+{
+	Particle particle;
 
     // Set position
 	particle.Position = particleInit.Position;
-    particle.Position.x += particleInit.PositionVariation.x * (RandomFloat01() - 0.5f);
-    particle.Position.y += particleInit.PositionVariation.y * (RandomFloat01() - 0.5f);
-    particle.Position.z += particleInit.PositionVariation.z * (RandomFloat01() - 0.5f);
+    particle.Position.x += particleInit.PositionVariation.x * (r[0] - 0.5f);
+    particle.Position.y += particleInit.PositionVariation.y * (r[1] - 0.5f);
+    particle.Position.z += particleInit.PositionVariation.z * (r[2] - 0.5f);
 
     // Set rotation
-	particle.Rotation = RandomFloat01() * 2.0f * 3.14;
+	particle.Rotation = r[3] * 2.0f * 3.14f;
 
 	// Velocity
 	particle.Velocity = particleInit.Velocity;
-    particle.Velocity.x += particleInit.VelocityVariation.x * (RandomFloat01() - 0.5f);
-    particle.Velocity.y += particleInit.VelocityVariation.y * (RandomFloat01() - 0.5f);
-    particle.Velocity.z += particleInit.VelocityVariation.z * (RandomFloat01() - 0.5f);
+    particle.Velocity.x += particleInit.VelocityVariation.x * (r[4] - 0.5f);
+    particle.Velocity.y += particleInit.VelocityVariation.y * (r[5] - 0.5f);
+    particle.Velocity.z += particleInit.VelocityVariation.z * (r[6] - 0.5f);
 
 	// Set color
 	particle.ColorBegin = particleInit.ColorBegin;
@@ -182,10 +640,210 @@ void ParticleSystem::Spawn(const ParticleInit& particleInit)
 	particle.LifeRemaining = particleInit.LifeTime;
 
     // Set size
-	particle.SizeBegin = particleInit.SizeBegin - particleInit.SizeVariation + (particleInit.SizeVariation * RandomFloat01());
+	particle.SizeBegin = particleInit.SizeBegin - particleInit.SizeVariation + (particleInit.SizeVariation * r[7]);
 	particle.SizeEnd = particleInit.SizeEnd;
 
-    // Update pool index
-    unsigned int newIndex = --poolIndex % particlePool.size();
-	poolIndex = newIndex;
+	return particle;
+}
+
+// Spawn particles
+void ParticleSystem::Spawn(const ParticleInit& particleInit, std::size_t count, std::uint32_t emitterIndex)
+{
+	if (0 == count)
+		return;
+
+	drawPrepared = false;
+
+	// The draw reads the settings of every emitter that has particles
+	if (emitterIndex >= emitterParams.size())
+	{
+		emitterParams.resize(std::size_t(emitterIndex) + 1);
+		emitterParamsChanged = true;
+	}
+
+	if (ParticleSimulation::analytic == simulation)
+	{
+		SpawnAnalytic(particleInit, count, emitterIndex);
+		return;
+	}
+
+	randoms.resize(count * kSpawnRandoms);
+	rng.fill_unit(randoms.data(), randoms.size());
+
+	if (ParticleSimulation::gpu == simulation)
+	{
+		// Emitted by the next Render()
+		pendingSpawns.reserve(pendingSpawns.size() + count);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			Particle particle = MakeParticle(particleInit, &randoms[i * kSpawnRandoms]);
+			pendingSpawns.push_back({
+				Vec4f{particle.Position.x, particle.Position.y, particle.Position.z, particle.LifeRemaining},
+				Vec4f{particle.Velocity.x, particle.Velocity.y, particle.Velocity.z, particle.LifeTime},
+				particle.ColorBegin,
+				particle.ColorEnd,
+				Vec4f{particle.SizeBegin, particle.SizeEnd, particle.Rotation, float(emitterIndex + 1)}
+			});
+		}
+		return;
+	}
+
+	SpawnCpu(particleInit, count, emitterIndex);
+}
+
+void ParticleSystem::SpawnCpu(const ParticleInit& particleInit, std::size_t count, std::uint32_t emitterIndex)
+{
+	if (aliveCount + count > poolSize && ParticleOverflow::grow == overflow)
+	{
+		while (aliveCount + count > poolSize)
+			poolSize = std::max<std::size_t>(1, 2 * poolSize);
+
+		particles.resize(poolSize);
+		instances.reserve(poolSize);
+	}
+
+	// Free slots first
+	std::size_t const fresh = std::min(count, poolSize - aliveCount);
+	for (std::size_t i = 0; i < fresh; ++i)
+	{
+		Particle particle = MakeParticle(particleInit, &randoms[i * kSpawnRandoms]);
+		particle.Emitter = emitterIndex;
+		StoreParticle(aliveCount++, particle);
+	}
+
+	if (fresh == count || ParticleOverflow::stealOldest != overflow || 0 == aliveCount)
+		return;
+
+	// Then replace the oldest particles. If the burst is larger than the
+	// pool, its last particles are the ones that survive, as they would if
+	// spawned one at a time.
+	std::size_t const steal = std::min(count - fresh, aliveCount);
+
+	oldest.resize(aliveCount);
+	for (std::size_t i = 0; i < aliveCount; ++i)
+		oldest[i] = i;
+
+	auto const by_serial = [this](std::size_t a, std::size_t b) {
+		return particles.serial[a] < particles.serial[b];
+	};
+	std::nth_element(oldest.begin(), oldest.begin() + (steal - 1), oldest.end(), by_serial);
+	std::sort(oldest.begin(), oldest.begin() + steal, by_serial);
+
+	for (std::size_t i = 0; i < steal; ++i)
+	{
+		std::size_t const burstIndex = count - steal + i;
+		Particle particle = MakeParticle(particleInit, &randoms[burstIndex * kSpawnRandoms]);
+		particle.Emitter = emitterIndex;
+		StoreParticle(oldest[i], particle);
+	}
+}
+
+// The random variations are left to particle_analytic.vert, which derives
+// them from the particle's seed
+void ParticleSystem::SpawnAnalytic(const ParticleInit& particleInit, std::size_t count, std::uint32_t emitterIndex)
+{
+	if (0 == poolSize)
+		return;
+
+	if (pendingAnalytic.empty())
+		pendingFirst = spawnCount;
+
+	std::uint32_t const current = epoch % 2;
+	float const spawnTime = float(time - epochStart[current]);
+	epochEnd[current] = std::max(epochEnd[current], time + particleInit.LifeTime);
+
+	pendingAnalytic.reserve(pendingAnalytic.size() + count);
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		pendingAnalytic.push_back({
+			Vec4f{particleInit.Position.x, particleInit.Position.y, particleInit.Position.z, spawnTime},
+			Vec4f{particleInit.PositionVariation.x, particleInit.PositionVariation.y, particleInit.PositionVariation.z, particleInit.LifeTime},
+			Vec4f{particleInit.Velocity.x, particleInit.Velocity.y, particleInit.Velocity.z, particleInit.SizeBegin},
+			Vec4f{particleInit.VelocityVariation.x, particleInit.VelocityVariation.y, particleInit.VelocityVariation.z, particleInit.SizeEnd},
+			particleInit.ColorBegin,
+			particleInit.ColorEnd,
+			particleInit.SizeVariation,
+			analyticSeed + std::uint32_t(spawnCount++),
+			emitterIndex,
+			epoch
+		});
+	}
+}
+
+void ParticleSystem::StoreParticle(std::size_t slot, const Particle& particle)
+{
+	particles.positionX[slot] = particle.Position.x;
+	particles.positionY[slot] = particle.Position.y;
+	particles.positionZ[slot] = particle.Position.z;
+	particles.velocityX[slot] = particle.Velocity.x;
+	particles.velocityY[slot] = particle.Velocity.y;
+	particles.velocityZ[slot] = particle.Velocity.z;
+	particles.rotation[slot] = particle.Rotation;
+	particles.lifeRemaining[slot] = particle.LifeRemaining;
+	particles.active[slot] = 1.0f;
+	particles.lifeTime[slot] = particle.LifeTime;
+	particles.sizeBegin[slot] = particle.SizeBegin;
+	particles.sizeEnd[slot] = particle.SizeEnd;
+	particles.colorBegin[slot] = particle.ColorBegin;
+	particles.colorEnd[slot] = particle.ColorEnd;
+	particles.serial[slot] = spawnCount++;
+	particles.emitter[slot] = particle.Emitter;
+}
+
+void ParticleSystem::Emit(ParticleEmitter& emitter, float ts, std::uint32_t emitterIndex)
+{
+	Spawn(emitter.Init, emitter.Advance(ts), emitterIndex);
+}
+
+void ParticleSystem::SetEmitterParams(std::uint32_t emitterIndex, const ParticleEmitterParams& params)
+{
+	if (emitterIndex >= emitterParams.size())
+		emitterParams.resize(std::size_t(emitterIndex) + 1);
+
+	emitterParams[emitterIndex] = params;
+	emitterParamsChanged = true;
+}
+
+void ParticleSystem::SetSort(ParticleSort newSort)
+{
+	sort = newSort;
+	drawPrepared = false;
+}
+
+void ParticleSystem::SetBlend(ParticleBlend newBlend)
+{
+	blend = newBlend;
+	drawPrepared = false;
+
+	if (ParticleBlend::weightedOit == blend && !oitProgram)
+	{
+		oitProgram = &get_program({{GL_VERTEX_SHADER, vertexShader},
+		                           {GL_FRAGMENT_SHADER, "assets/particle_oit.frag"}});
+	}
+}
+
+ShaderProgram& ParticleSystem::DrawProgram() const
+{
+	return ParticleBlend::weightedOit == blend ? *oitProgram : *particleProgram;
+}
+
+// Weighted blended OIT does not depend on the order
+bool ParticleSystem::SortsBackToFront() const
+{
+	return ParticleSort::backToFront == sort && ParticleBlend::alpha == blend;
+}
+
+void ParticleSystem::Seed(std::uint64_t seed)
+{
+	rng.seed(seed);
+	analyticSeed = std::uint32_t((seed * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+std::size_t ParticleEmitter::Advance(float ts, float rateScale)
+{
+	Carry += Rate * rateScale * ts;
+
+	float const due = std::floor(Carry);
+	Carry -= due;
+	return due > 0.0f ? std::size_t(due) : 0;
 }
@@ -7,9 +7,14 @@
 #include <glad.h>
 #include "../support/program.hpp"
 
+#include "fast_random.hpp"
+#include "particle_sort.hpp"
+#include "particle_store.hpp"
+
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <random>
 
 struct ParticleInit
 {
@@ -20,16 +25,178 @@ struct ParticleInit
 	float LifeTime = 1.0f;
 };
 
+// Spawns particles at a fixed rate, independent of the frame rate (see
+// ParticleSystem::Emit())
+struct ParticleEmitter
+{
+	ParticleInit Init;
+	float Rate = 60.0f; // particles per second
+
+	// Level of detail, applied by ParticleManager. While the emitter's
+	// bounds cover a radius of fewer than LodPixels pixels on screen, it
+	// spawns fewer particles (down to MinRateScale times Rate), drawn larger
+	// so that they cover the same area. 0 disables.
+	float LodPixels = 0.0f;
+	float MinRateScale = 0.1f;
+
+	// Number of particles due after another ts seconds, at rateScale times
+	// Rate. Fractions of a particle carry over to the next call.
+	std::size_t Advance(float ts, float rateScale = 1.0f);
+
+	float Carry = 0.0f;
+};
+
+// Resolution at which an emitter's particles are drawn, when alpha blended
+//  - full: directly onto the framebuffer
+//  - half, quarter: into an offscreen target with half or a quarter of the
+//    framebuffer's width and height, which is then upsampled onto it (see
+//    particle_offscreen.hpp). Large, soft particles lose little detail, and
+//    cover 4 or 16 times fewer pixels.
+// Only applies to ParticleBlend::alpha, and only the caller acts on it: it
+// draws each resolution in use in its own pass (see ParticleSystem::Render()),
+// into whatever framebuffer it has bound.
+enum class ParticleResolution : std::uint32_t
+{
+	full,
+	half,
+	quarter
+};
+
+// Settings of an emitter that apply to all of its particles when they are
+// drawn, so they can be changed without touching the particles. Each
+// particle records the index of its emitter; the draw reads the emitters'
+// settings from a storage buffer (std430, see particle.vert).
+struct ParticleEmitterParams
+{
+	Vec4f Tint{ 1.0f, 1.0f, 1.0f, 1.0f }; // multiplies the particles' color
+	float SizeScale = 1.0f;
+	ParticleResolution Resolution = ParticleResolution::full;
+	float Padding[2] = {};
+};
+
+// Where particles are simulated
+//  - cpu: particles live in host memory, and are uploaded for drawing
+//  - gpu: particles live in shader storage buffers, and are updated and
+//    emitted by compute shaders (particle_update.comp, particle_emit.comp).
+//    Nothing is read back; the number of particles to draw is written by
+//    the compute shaders into an indirect draw command.
+//  - analytic: particles are not simulated. Spawn() writes each particle's
+//    spawn time, seed and ParticleInit once, and particle_analytic.vert
+//    evaluates its position, rotation, size and color from the current
+//    time. Only suited to ballistic particles (constant velocity), but the
+//    CPU cost per frame does not depend on the number of particles.
+enum class ParticleSimulation
+{
+	cpu,
+	gpu,
+	analytic
+};
+
+// What Spawn() does when all particles in the pool are alive
+//  - drop: the new particle is discarded
+//  - stealOldest: the particle that was spawned first is replaced
+//  - grow: the pool's capacity is doubled
+// The gpu simulation always drops. The analytic simulation always replaces
+// the particle that was spawned first.
+enum class ParticleOverflow
+{
+	drop,
+	stealOldest,
+	grow
+};
+
+// How particles are drawn
+//  - cube: a small cube, spinning about all three axes
+//  - billboard: a quad facing the camera, spinning in the view plane. Its
+//    alpha falls off radially from the center (see CreateSpriteTexture()).
+//    Needs the camera's orientation, see ParticleSystem::Render().
+enum class ParticleShape
+{
+	cube,
+	billboard
+};
+
+// Edge of a particle's cube or quad at size 1
+constexpr float kParticleShapeSize = 0.1f;
+
+// Order in which particles are drawn
+//  - none: storage order
+//  - backToFront: by decreasing distance along the view direction, as
+//    needed for alpha blending. The cpu simulation sorts with a parallel
+//    radix sort (see particle_sort.hpp), and the gpu simulation with a
+//    compute shader bitonic sort (particle_sort.comp). The analytic
+//    simulation does not know where its particles are, and draws them in
+//    spawn order.
+enum class ParticleSort
+{
+	none,
+	backToFront
+};
+
+// How overlapping particles are composited
+//  - alpha: alpha blended onto the bound framebuffer, in the order set by
+//    SetSort(). The caller enables blending.
+//  - weightedOit: weighted blended order-independent transparency. Render()
+//    must be called between ParticleOit::begin() and end() (see
+//    particle_oit.hpp). Particles are never sorted.
+enum class ParticleBlend
+{
+	alpha,
+	weightedOit
+};
+
 class ParticleSystem
 {
 public:
-    ParticleSystem();
+    // Pool with room for poolSize particles
+    explicit ParticleSystem(std::size_t poolSize = 1000, ParticleSimulation simulation = ParticleSimulation::cpu, ParticleOverflow overflow = ParticleOverflow::stealOldest, ParticleShape shape = ParticleShape::cube);
+    ~ParticleSystem();
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
 
     void Update(float ts);
-    void Render(Mat44f projCameraWorld);
+    // Draws all live particles with a single instanced draw call. With gpu
+    // simulation, particles spawned since the last call are emitted first.
+    // Billboards face, and sorting is relative to, the camera given by
+    // cameraWorld, the transform from the particles' space to camera space.
+    void Render(Mat44f projCameraWorld, Mat44f cameraWorld = kIdentity44f);
+    // Draws only the particles of emitters drawn at the given resolution.
+    // The passes of a frame share the emission, sort and upload done by the
+    // first of them.
+    void Render(Mat44f projCameraWorld, Mat44f cameraWorld, ParticleResolution resolution);
+
+    // Spawn count particles at once, on behalf of emitter emitterIndex.
+    // Their random variations are generated in bulk.
+    void Spawn(const ParticleInit& particleInit, std::size_t count = 1, std::uint32_t emitterIndex = 0);
 
-    void Spawn(const ParticleInit& particleInit);
+    // Spawn the particles that emitter has due after ts seconds
+    void Emit(ParticleEmitter& emitter, float ts, std::uint32_t emitterIndex = 0);
+
+    // Draw settings of emitter emitterIndex. Emitters that were never set
+    // use the defaults.
+    void SetEmitterParams(std::uint32_t emitterIndex, const ParticleEmitterParams& params);
+
+    // Draw order, backToFront by default. Sorting uses the cameraWorld
+    // passed to Render().
+    void SetSort(ParticleSort sort);
+
+    // Compositing, alpha by default
+    void SetBlend(ParticleBlend blend);
+
+    // Whether any emitter is drawn at resolution (see ParticleEmitterParams)
+    bool UsesResolution(ParticleResolution resolution) const;
+
+    // Restart the random sequence, for reproducible results. Systems are
+    // seeded with a fixed value on construction.
+    void Seed(std::uint64_t seed);
+
+    std::size_t Capacity() const { return poolSize; }
+    std::size_t AliveCount() const { return aliveCount; } // cpu only
 private:
+	// Spawned particle, before it is stored. Made from kSpawnRandoms random
+	// numbers.
+	static constexpr std::size_t kSpawnRandoms = 8;
 	struct Particle
 	{
 		Vec3f Position;
@@ -41,10 +208,129 @@ private:
 		float LifeTime = 1.0f;
 		float LifeRemaining = 0.0f;
 
-		bool Active = false;
+		std::uint32_t Emitter = 0;
+	};
+	// Per-instance attributes, see particle.vert
+	struct Instance
+	{
+		Vec4f CenterSize;
+		Vec4f Color;
+		float Rotation;
+		std::uint32_t Emitter;
+	};
+
+	// Particle as stored in the gpu simulation's buffers (std430 layout,
+	// see particle_update.comp)
+	struct GpuParticle
+	{
+		Vec4f PositionLife;
+		Vec4f VelocityLifeTime;
+		Vec4f ColorBegin, ColorEnd;
+		Vec4f SizeRotation; // begin size, end size, rotation, emitter + 1 (0: dead)
+	};
+
+	// Particle of the analytic simulation, as written by Spawn() (see
+	// particle_analytic.vert)
+	struct AnalyticParticle
+	{
+		Vec4f PositionSpawn; // w: spawn time, relative to the epoch
+		Vec4f PositionVariationLife; // w: life time
+		Vec4f VelocitySizeBegin;
+		Vec4f VelocityVariationSizeEnd;
+		Vec4f ColorBegin, ColorEnd;
+		float SizeVariation;
+		std::uint32_t Seed;
+		std::uint32_t Emitter;
+		std::uint32_t Epoch;
 	};
-	std::vector<Particle> particlePool;
-	uint32_t poolIndex = 999;
 
-	GLuint cubeVA = 0;
+	void RenderEmitters(const Mat44f& projCameraWorld, const Mat44f& cameraWorld, GLint resolution);
+	void PrepareDraw(const Mat44f& cameraWorld);
+	void SetShapeUniforms(const Mat44f& cameraWorld);
+	void BindEmitterParams();
+	ShaderProgram& DrawProgram() const;
+	bool SortsBackToFront() const;
+	void CreateGpuBuffers();
+	void EmitGpu();
+	void SortGpu(const Mat44f& cameraWorld);
+	void UploadAnalytic();
+
+	static Particle MakeParticle(const ParticleInit& init, const float* randoms);
+	static GLuint CreateSpriteTexture();
+	void StoreParticle(std::size_t slot, const Particle& particle);
+	void SpawnCpu(const ParticleInit& particleInit, std::size_t count, std::uint32_t emitterIndex);
+	void SpawnAnalytic(const ParticleInit& particleInit, std::size_t count, std::uint32_t emitterIndex);
+
+	ParticleSimulation simulation;
+	ParticleOverflow overflow;
+	ParticleShape shape;
+	ParticleSort sort = ParticleSort::backToFront;
+	ParticleBlend blend = ParticleBlend::alpha;
+	std::size_t poolSize;
+
+	// cpu only; the first aliveCount particles are alive
+	ParticleStore particles;
+	std::size_t aliveCount = 0;
+
+	std::uint64_t spawnCount = 0; // cpu and analytic
+
+	FastRandom rng;
+	std::vector<float> randoms; // for the current burst
+	std::vector<std::size_t> oldest; // for the current burst
+
+	std::vector<Instance> instances; // live particles, rebuilt each frame
+
+	// Set by PrepareDraw() for the passes that follow, until the particles
+	// or the camera change
+	bool drawPrepared = false;
+	Mat44f preparedCameraWorld = kIdentity44f;
+
+	// Uploaded to emitterSB when changed
+	std::vector<ParticleEmitterParams> emitterParams = std::vector<ParticleEmitterParams>(1);
+	bool emitterParamsChanged = true;
+	GLuint emitterSB = 0;
+	std::size_t emitterSBCount = 0; // emitters the buffer has room for
+
+	// Depth sort of the live particles (cpu only)
+	std::vector<std::uint32_t> sortKeys, sortOrder;
+	RadixSortScratch sortScratch;
+
+	GLuint shapeVA = 0;
+	GLuint shapeVB = 0, shapeIB = 0;
+	GLsizei shapeIndexCount;
+	GLuint particleTexture = 0; // billboard only
+	GLuint instanceVB = 0; // sized for the whole pool
+	char const* vertexShader = "assets/particle.vert";
+	ShaderProgram* particleProgram = nullptr;
+	ShaderProgram* oitProgram = nullptr; // created by SetBlend()
+
+	// gpu only
+	std::vector<GpuParticle> pendingSpawns;
+	GLuint particleSB = 0, freeListSB = 0, aliveListSB = 0, spawnSB = 0;
+	GLuint drawCommandB = 0; // indirect draw command, also a storage buffer
+	std::size_t spawnCapacity = 0;
+	GLuint sortSB = 0; // sortSize (key, index) pairs
+	std::size_t sortSize = 0; // power of two
+
+	ShaderProgram* updateProgram = nullptr;
+	ShaderProgram* emitProgram = nullptr;
+	ShaderProgram* sortProgram = nullptr;
+
+	// analytic only. Particles are stored in a ring, particle n in slot
+	// n % poolSize; pendingAnalytic are the ones spawned since the last
+	// Render(), starting with particle number pendingFirst.
+	double time = 0.0;
+
+	// Spawn times are floats relative to an epoch, so that they keep their
+	// precision however long the system runs. A new epoch starts every
+	// kEpochLength seconds, in the slot (epoch % 2) of an epoch whose
+	// particles have all died; particles whose epoch is neither of the two
+	// current ones are dead.
+	static constexpr double kEpochLength = 64.0;
+	std::uint32_t epoch = 0; // of new particles
+	double epochStart[2] = {};
+	double epochEnd[2] = {}; // when the epoch's last particle dies
+	std::uint32_t analyticSeed = 0;
+	std::vector<AnalyticParticle> pendingAnalytic;
+	std::uint64_t pendingFirst = 0;
 };
\ No newline at end of file
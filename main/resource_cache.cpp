@@ -0,0 +1,192 @@
+#include "resource_cache.hpp"
+
+#include <exception>
+#include <filesystem>
+#include <system_error>
+
+namespace {
+std::string canonical_key_(std::string const &aPath) {
+  // Different spellings of the same path ("assets/../assets/x.png") map to
+  // the same key. The file need not exist.
+  std::error_code ec;
+  auto const path = std::filesystem::weakly_canonical(aPath, ec);
+  return ec ? aPath : path.string();
+}
+
+template <typename tHandle, typename tRequest>
+tHandle const &find_or_request_(std::unordered_map<std::string, tHandle> &aMap,
+                                std::string aKey, tRequest &&aRequest) {
+  auto it = aMap.find(aKey);
+  if (aMap.end() == it)
+    it = aMap.emplace(std::move(aKey), aRequest()).first;
+  return it->second;
+}
+
+// Resources whose loading failed hold no GL objects; they are dropped as
+// well, so that the next request retries.
+template <typename tResource>
+bool is_settled_(tResource &aRes, bool &aFailed) {
+  aFailed = false;
+  try {
+    return aRes.ready();
+  } catch (std::exception const &) {
+    aFailed = true;
+    return true;
+  }
+}
+
+void release_(GLuint aTexture) { glDeleteTextures(1, &aTexture); }
+void release_(SimpleMeshBuffers const &aBuffers) {
+  delete_mesh_buffers(aBuffers);
+}
+void release_(std::shared_ptr<CompressedImage const> const &) {
+  // Host memory; freed with the last reference
+}
+
+template <typename tValue> void release_(AsyncResource<tValue> &aRes) {
+  release_(aRes.value());
+}
+void release_(StreamedTexture &) {
+  // The texture is deleted with the last reference
+}
+
+template <typename tHandle>
+void collect_(std::unordered_map<std::string, tHandle> &aMap, bool aAll) {
+  for (auto it = aMap.begin(); it != aMap.end();) {
+    auto &res = *it->second;
+
+    // The loader holds references to resources that are still in flight
+    bool failed = false;
+    if (!aAll && (1 != it->second.use_count() || !is_settled_(res, failed))) {
+      ++it;
+      continue;
+    }
+
+    if (aAll && !is_settled_(res, failed)) {
+      // Still being uploaded; its objects are destroyed with the context
+      it = aMap.erase(it);
+      continue;
+    }
+
+    if (!failed)
+      release_(res);
+
+    it = aMap.erase(it);
+  }
+}
+
+template <typename tHandle>
+void append_info_(std::vector<ResourceCache::ResourceInfo> &aInfo,
+                  std::unordered_map<std::string, tHandle> const &aMap) {
+  for (auto const &[key, handle] : aMap)
+    aInfo.push_back({key, handle->bytes(), handle.use_count() - 1});
+}
+} // namespace
+
+StreamedTexture::StreamedTexture(ImageHandle aImage)
+    : mImage(std::move(aImage)) {}
+
+bool StreamedTexture::ready() {
+  if (mTexture)
+    return true;
+
+  if (!mImage->ready())
+    return false;
+
+  mTexture = std::make_unique<StreamingTexture>(mImage->value());
+  mImage.reset();
+  return true;
+}
+
+StreamingTexture &StreamedTexture::texture() noexcept { return *mTexture; }
+
+std::size_t StreamedTexture::bytes() const noexcept {
+  return mTexture ? mTexture->bytes() : 0;
+}
+
+ResourceCache::ResourceCache(AssetLoader &aLoader) : mLoader(aLoader) {}
+
+ResourceCache::~ResourceCache() {
+  collect_(mStreamedTextures, true);
+  collect_(mTextures, true);
+  collect_(mImages, true);
+  collect_(mMeshes, true);
+}
+
+ResourceCache::TextureHandle
+ResourceCache::texture_2d(std::string const &aPath) {
+  return find_or_request_(mTextures, "texture:" + canonical_key_(aPath),
+                          [&] { return mLoader.request_texture_2d(aPath); });
+}
+
+ResourceCache::ImageHandle
+ResourceCache::compressed_image(std::string const &aPath) {
+  return find_or_request_(mImages, "image:" + canonical_key_(aPath), [&] {
+    return mLoader.request_compressed_image(aPath);
+  });
+}
+
+ResourceCache::StreamedTextureHandle
+ResourceCache::streamed_texture(std::string const &aPath) {
+  return find_or_request_(
+      mStreamedTextures, "streamed:" + canonical_key_(aPath), [&] {
+        return std::make_shared<StreamedTexture>(compressed_image(aPath));
+      });
+}
+
+ResourceCache::MeshHandle ResourceCache::mesh(std::string const &aSmeshPath,
+                                              std::string const &aObjPath,
+                                              VertexLayout aLayout) {
+  // The layout determines the buffers, so it is part of the key
+  auto key = "mesh:" + canonical_key_(aSmeshPath) + "|" +
+             canonical_key_(aObjPath) +
+             (VertexLayout::interleaved == aLayout ? "|interleaved"
+                                                   : "|separate");
+
+  return find_or_request_(mMeshes, std::move(key), [&] {
+    return mLoader.request_mesh(aSmeshPath, aObjPath, aLayout);
+  });
+}
+
+void ResourceCache::collect() {
+  // Streamed textures first, as they may hold the last user of an image
+  collect_(mStreamedTextures, false);
+  collect_(mTextures, false);
+  collect_(mImages, false);
+  collect_(mMeshes, false);
+}
+
+std::size_t ResourceCache::stream_textures(std::size_t aByteBudget) {
+  std::size_t uploaded = 0;
+  for (auto const &[key, handle] : mStreamedTextures) {
+    bool failed = false;
+    if (!is_settled_(*handle, failed) || failed)
+      continue;
+
+    auto &texture = handle->texture();
+    if (texture.complete())
+      continue;
+
+    uploaded += texture.stream(aByteBudget - uploaded);
+    if (uploaded >= aByteBudget)
+      break;
+  }
+
+  return uploaded;
+}
+
+std::vector<ResourceCache::ResourceInfo> ResourceCache::resources() const {
+  std::vector<ResourceInfo> ret;
+  append_info_(ret, mTextures);
+  append_info_(ret, mImages);
+  append_info_(ret, mStreamedTextures);
+  append_info_(ret, mMeshes);
+  return ret;
+}
+
+std::size_t ResourceCache::total_bytes() const {
+  std::size_t total = 0;
+  for (auto const &info : resources())
+    total += info.bytes;
+  return total;
+}
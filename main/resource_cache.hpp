@@ -0,0 +1,123 @@
+#ifndef RESOURCE_CACHE_HPP_61D0A4B8_2E7C_4F19_8B3A_C5E9D27F4A10
+#define RESOURCE_CACHE_HPP_61D0A4B8_2E7C_4F19_8B3A_C5E9D27F4A10
+
+#include <glad.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+
+#include "asset_loader.hpp"
+#include "texture.hpp"
+
+/* Texture streamed in from a compressed image (see StreamingTexture)
+ *
+ * The texture is created by the first call to ready() after its image has
+ * been loaded; the image's handle is dropped then, so that the cache can
+ * release it once the texture no longer needs it either.
+ */
+class StreamedTexture final
+{
+	public:
+		using ImageHandle = std::shared_ptr<AsyncResource<std::shared_ptr<CompressedImage const>>>;
+
+		explicit StreamedTexture( ImageHandle );
+
+		StreamedTexture( StreamedTexture const& ) = delete;
+		StreamedTexture& operator= (StreamedTexture const&) = delete;
+
+	public:
+		// Throws an Error if loading the image failed.
+		bool ready();
+
+		// Only valid once ready() has returned true
+		StreamingTexture& texture() noexcept;
+
+		// GPU memory of the texture; zero until ready() has returned true
+		std::size_t bytes() const noexcept;
+
+	private:
+		ImageHandle mImage;
+		std::unique_ptr<StreamingTexture> mTexture;
+};
+
+/* Path-keyed cache in front of an AssetLoader
+ *
+ * Requests for the same asset (by canonical path, and for meshes, layout)
+ * return the same shared handle, so each asset is loaded and uploaded only
+ * once, and all users share the same GL objects.
+ *
+ * The cache keeps its own reference to each resource. collect() releases
+ * resources that nobody else references anymore, deleting their GL objects;
+ * hold on to a handle for as long as its GL objects (or VAOs created from
+ * them) are in use.
+ *
+ * All methods must be called from the render thread.
+ */
+class ResourceCache final
+{
+	public:
+		using TextureHandle = std::shared_ptr<AsyncResource<GLuint>>;
+		using MeshHandle = std::shared_ptr<AsyncResource<SimpleMeshBuffers>>;
+		using ImageHandle = StreamedTexture::ImageHandle;
+		using StreamedTextureHandle = std::shared_ptr<StreamedTexture>;
+
+		struct ResourceInfo
+		{
+			std::string key;
+			std::size_t bytes; // zero while loading
+			long users; // excluding the cache
+		};
+
+	public:
+		explicit ResourceCache( AssetLoader& );
+
+		// Deletes the GL objects of all resources
+		~ResourceCache();
+
+		ResourceCache( ResourceCache const& ) = delete;
+		ResourceCache& operator= (ResourceCache const&) = delete;
+
+	public:
+		TextureHandle texture_2d( std::string const& aPath );
+		ImageHandle compressed_image( std::string const& aPath );
+
+		// Requires support for a compressed format (see
+		// AssetLoader::supports_compressed_textures())
+		StreamedTextureHandle streamed_texture( std::string const& aPath );
+
+		MeshHandle mesh(
+			std::string const& aSmeshPath,
+			std::string const& aObjPath,
+			VertexLayout = VertexLayout::separate
+		);
+
+		// Release resources that are only referenced by the cache. Resources
+		// that are still loading are kept.
+		void collect();
+
+		// Upload finer mip levels of the streamed textures that are ready,
+		// up to aByteBudget bytes in total (see StreamingTexture::stream()).
+		// Returns the number of bytes uploaded.
+		std::size_t stream_textures( std::size_t aByteBudget );
+
+		// Per-resource statistics, and their total in bytes
+		std::vector<ResourceInfo> resources() const;
+		std::size_t total_bytes() const;
+
+	private:
+		template< typename tHandle >
+		using Map_ = std::unordered_map<std::string,tHandle>;
+
+		AssetLoader& mLoader;
+
+		Map_<TextureHandle> mTextures;
+		Map_<ImageHandle> mImages;
+		Map_<StreamedTextureHandle> mStreamedTextures;
+		Map_<MeshHandle> mMeshes;
+};
+
+#endif // RESOURCE_CACHE_HPP_61D0A4B8_2E7C_4F19_8B3A_C5E9D27F4A10
@@ -1,66 +1,223 @@
 #include "simple_mesh.hpp"
 
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+
 SimpleMeshData concatenate( SimpleMeshData aM, SimpleMeshData const& aN )
 {
+	assert( aM.lods.empty() && aN.lods.empty() );
+
 	aM.positions.insert( aM.positions.end(), aN.positions.begin(), aN.positions.end() );
 	aM.colors.insert( aM.colors.end(), aN.colors.begin(), aN.colors.end() );
 	aM.normals.insert( aM.normals.end(), aN.normals.begin(), aN.normals.end() );
     aM.texcoords.insert( aM.texcoords.end(), aN.texcoords.begin(), aN.texcoords.end() );
+
+	// Indices of the second mesh refer to its own vertices, which now start
+	// after the first mesh's vertices
+	auto const base = std::uint32_t(aM.positions.size() - aN.positions.size());
+	aM.indices.reserve( aM.indices.size() + aN.indices.size() );
+	for( auto const index : aN.indices )
+		aM.indices.push_back( base + index );
+
 	return aM;
 }
 
-GLuint create_vao( SimpleMeshData const& aMeshData )
+BoundingSphere compute_bounding_sphere( Vec3f const* aPositions, std::size_t aCount, std::size_t aStride )
 {
-    GLuint positionVBO = 0;
-    glGenBuffers(1, &positionVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
-    glBufferData( GL_ARRAY_BUFFER, aMeshData.positions.size() * sizeof(Vec3f), aMeshData.positions.data(), GL_STATIC_DRAW );
-    
+	if( 0 == aCount )
+		return { Vec3f{ 0.f, 0.f, 0.f }, 0.f };
+
+	auto const position = [&] (std::size_t aIndex) -> Vec3f const& {
+		return *reinterpret_cast<Vec3f const*>( reinterpret_cast<unsigned char const*>(aPositions) + aIndex * aStride );
+	};
+
+	Vec3f lo = position( 0 ), hi = position( 0 );
+	for( std::size_t i = 1; i < aCount; ++i )
+	{
+		Vec3f const& p = position( i );
+		lo = Vec3f{ std::min( lo.x, p.x ), std::min( lo.y, p.y ), std::min( lo.z, p.z ) };
+		hi = Vec3f{ std::max( hi.x, p.x ), std::max( hi.y, p.y ), std::max( hi.z, p.z ) };
+	}
+
+	BoundingSphere ret{ 0.5f * (lo + hi), 0.f };
+	for( std::size_t i = 0; i < aCount; ++i )
+		ret.radius = std::max( ret.radius, length( position( i ) - ret.center ) );
+
+	return ret;
+}
+
+std::vector<InterleavedVertex> interleave_vertices( SimpleMeshData const& aMeshData )
+{
+	std::vector<InterleavedVertex> vertices( aMeshData.positions.size(), InterleavedVertex{} );
+	for( std::size_t i = 0; i < vertices.size(); ++i )
+	{
+		vertices[i].position = aMeshData.positions[i];
+		if( i < aMeshData.colors.size() )
+			vertices[i].color = aMeshData.colors[i];
+		if( i < aMeshData.normals.size() )
+			vertices[i].normal = aMeshData.normals[i];
+		if( i < aMeshData.texcoords.size() )
+			vertices[i].texcoord = aMeshData.texcoords[i];
+	}
+
+	return vertices;
+}
+
+namespace
+{
+	// Upload vertex data in the layout given by aBuffers.layout
+	void upload_vertex_data_( SimpleMeshBuffers& aBuffers, SimpleMeshData const& );
+}
+
+GLuint create_vao( SimpleMeshData const& aMeshData, VertexLayout aLayout )
+{
+    SimpleMeshBuffers buffers;
+    buffers.layout = aLayout;
+
+    upload_vertex_data_( buffers, aMeshData );
+
+    return create_vao( buffers );
+}
+
+GLuint create_indexed_vao( SimpleMeshData const& aMeshData, VertexLayout aLayout )
+{
+    return create_vao( create_mesh_buffers( aMeshData, aLayout ) );
+}
+
+SimpleMeshBuffers create_mesh_buffers( SimpleMeshData const& aMeshData, VertexLayout aLayout )
+{
+    SimpleMeshBuffers buffers;
+    buffers.layout = aLayout;
+
+    upload_vertex_data_( buffers, aMeshData );
+
+    if( !aMeshData.indices.empty() )
+    {
+        glGenBuffers(1, &buffers.indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, aMeshData.indices.size() * sizeof(std::uint32_t), aMeshData.indices.data(), GL_STATIC_DRAW);
+
+        buffers.indexCount = aMeshData.indices.size();
+    }
+
+    buffers.lods = aMeshData.lods;
+    if( buffers.lods.empty() )
+    {
+        auto const count = buffers.indexCount ? buffers.indexCount : buffers.vertexCount;
+        buffers.lods.push_back( { 0, std::uint32_t(count), 0.f } );
+    }
+
+    buffers.bounds = compute_bounding_sphere( aMeshData.positions.data(), aMeshData.positions.size() );
 
-    GLuint colorVBO = 0;
-    glGenBuffers(1, &colorVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-    glBufferData( GL_ARRAY_BUFFER, aMeshData.colors.size() * sizeof(Vec3f), aMeshData.colors.data(), GL_STATIC_DRAW );
+    buffers.chunks = aMeshData.chunks;
+    if( buffers.chunks.empty() )
+        buffers.chunks.push_back( { buffers.bounds, 0, std::uint32_t(buffers.lods.size()) } );
 
-    GLuint normalsVBO = 0;
-    glGenBuffers(1, &normalsVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-    glBufferData( GL_ARRAY_BUFFER, aMeshData.normals.size() * sizeof(Vec3f), aMeshData.normals.data(), GL_STATIC_DRAW );
+    return buffers;
+}
 
-    // Texture VBO
-    GLuint textureVBO = 0;
-    glGenBuffers(1, &textureVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, textureVBO);
-    glBufferData(GL_ARRAY_BUFFER, aMeshData.texcoords.size() * sizeof(Vec2f), aMeshData.texcoords.data(), GL_STATIC_DRAW);
+void delete_mesh_buffers( SimpleMeshBuffers const& aBuffers )
+{
+    glDeleteBuffers( 4, aBuffers.vertexBuffers );
+    glDeleteBuffers( 1, &aBuffers.indexBuffer );
+}
 
+std::size_t mesh_buffer_bytes( SimpleMeshBuffers const& aBuffers )
+{
+    // Both layouts store the same attributes
+    std::size_t const vertexBytes = 3 * sizeof(Vec3f) + sizeof(Vec2f);
+    return aBuffers.vertexCount * vertexBytes + aBuffers.indexCount * sizeof(std::uint32_t);
+}
+
+GLuint create_vao( SimpleMeshBuffers const& aBuffers )
+{
     GLuint vao = 0;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    // Position VBO
-    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
+    if( VertexLayout::interleaved == aBuffers.layout )
+    {
+        // All attributes read from binding point 0, at different offsets
+        glVertexAttribFormat( 0, 3, GL_FLOAT, GL_FALSE, offsetof(InterleavedVertex, position) );
+        glVertexAttribFormat( 1, 3, GL_FLOAT, GL_FALSE, offsetof(InterleavedVertex, color) );
+        glVertexAttribFormat( 2, 3, GL_FLOAT, GL_FALSE, offsetof(InterleavedVertex, normal) );
+        glVertexAttribFormat( 3, 2, GL_FLOAT, GL_FALSE, offsetof(InterleavedVertex, texcoord) );
 
-    // Color VBO
-    glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(1);
-    
-    // Normal VBO
-    glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(2);
+        for( GLuint attrib = 0; attrib < 4; ++attrib )
+        {
+            glVertexAttribBinding( attrib, 0 );
+            glEnableVertexAttribArray( attrib );
+        }
+
+        glBindVertexBuffer( 0, aBuffers.vertexBuffers[0], 0, sizeof(InterleavedVertex) );
+    }
+    else
+    {
+        // Position VBO
+        glBindBuffer(GL_ARRAY_BUFFER, aBuffers.vertexBuffers[0]);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(0);
+
+        // Color VBO
+        glBindBuffer(GL_ARRAY_BUFFER, aBuffers.vertexBuffers[1]);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(1);
 
-    // Texture VBO - index 3
-    glBindBuffer(GL_ARRAY_BUFFER, textureVBO);
-    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(3);
+        // Normal VBO
+        glBindBuffer(GL_ARRAY_BUFFER, aBuffers.vertexBuffers[2]);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(2);
 
+        // Texture VBO - index 3
+        glBindBuffer(GL_ARRAY_BUFFER, aBuffers.vertexBuffers[3]);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(3);
+    }
+
+    // Element buffer binding is part of the VAO state
+    if( aBuffers.indexBuffer )
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, aBuffers.indexBuffer);
 
     return vao;
 }
 
+GLuint create_instance_buffer( GLuint aVao, std::vector<Mat44f> const& aModel2World )
+{
+    // Mat44f is row-major, whereas matrix attributes are read column by
+    // column. Upload the transposed matrices, so that each attribute is one
+    // column.
+    std::vector<Mat44f> columns;
+    columns.reserve( aModel2World.size() );
+    for( auto const& model2world : aModel2World )
+        columns.emplace_back( transpose( model2world ) );
+
+    GLuint instanceVBO = 0;
+    glGenBuffers(1, &instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, columns.size() * sizeof(Mat44f), columns.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(aVao);
+
+    // Binding points 0-3 may be in use by the per-vertex attributes
+    // (glVertexAttribPointer() uses the binding point equal to the attribute
+    // index), so the instance data goes to binding point 4.
+    GLuint const binding = 4;
+    for( GLuint column = 0; column < 4; ++column )
+    {
+        GLuint const attrib = 4 + column;
+        glVertexAttribFormat(attrib, 4, GL_FLOAT, GL_FALSE, GLuint(column * 4 * sizeof(float)));
+        glVertexAttribBinding(attrib, binding);
+        glEnableVertexAttribArray(attrib);
+    }
+
+    glBindVertexBuffer(binding, instanceVBO, 0, sizeof(Mat44f));
+    glVertexBindingDivisor(binding, 1);
+
+    return instanceVBO;
+}
+
 GLuint create_rectangle(const Vec3f& topLeft, const Vec3f& topRight, const Vec3f& bottomLeft, const Vec3f& bottomRight, SimpleMeshData& rectangle) {
     
     Vec3f norm = { 0.f, 0.f, 0.f };
@@ -82,4 +239,45 @@ GLuint create_rectangle(const Vec3f& topLeft, const Vec3f& topRight, const Vec3f
     GLuint out_rectangle = create_vao(rectangle);
     
     return out_rectangle;
-}
\ No newline at end of file
+}
+
+namespace
+{
+	void upload_vertex_buffers_( SimpleMeshBuffers& aBuffers, SimpleMeshData const& aMeshData )
+	{
+		glGenBuffers( 4, aBuffers.vertexBuffers );
+
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffers.vertexBuffers[0] );
+		glBufferData( GL_ARRAY_BUFFER, aMeshData.positions.size() * sizeof(Vec3f), aMeshData.positions.data(), GL_STATIC_DRAW );
+
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffers.vertexBuffers[1] );
+		glBufferData( GL_ARRAY_BUFFER, aMeshData.colors.size() * sizeof(Vec3f), aMeshData.colors.data(), GL_STATIC_DRAW );
+
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffers.vertexBuffers[2] );
+		glBufferData( GL_ARRAY_BUFFER, aMeshData.normals.size() * sizeof(Vec3f), aMeshData.normals.data(), GL_STATIC_DRAW );
+
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffers.vertexBuffers[3] );
+		glBufferData( GL_ARRAY_BUFFER, aMeshData.texcoords.size() * sizeof(Vec2f), aMeshData.texcoords.data(), GL_STATIC_DRAW );
+
+		aBuffers.vertexCount = aMeshData.positions.size();
+	}
+
+	void upload_interleaved_vertex_buffer_( SimpleMeshBuffers& aBuffers, SimpleMeshData const& aMeshData )
+	{
+		auto const vertices = interleave_vertices( aMeshData );
+
+		glGenBuffers( 1, aBuffers.vertexBuffers );
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffers.vertexBuffers[0] );
+		glBufferData( GL_ARRAY_BUFFER, vertices.size() * sizeof(InterleavedVertex), vertices.data(), GL_STATIC_DRAW );
+
+		aBuffers.vertexCount = vertices.size();
+	}
+
+	void upload_vertex_data_( SimpleMeshBuffers& aBuffers, SimpleMeshData const& aMeshData )
+	{
+		if( VertexLayout::interleaved == aBuffers.layout )
+			upload_interleaved_vertex_buffer_( aBuffers, aMeshData );
+		else
+			upload_vertex_buffers_( aBuffers, aMeshData );
+	}
+}
@@ -5,8 +5,35 @@
 
 #include <vector>
 
+#include <cstddef>
+#include <cstdint>
+
 #include "../vmlib/vec3.hpp"
 #include "../vmlib/vec2.hpp"
+#include "../vmlib/mat44.hpp"
+
+// Index range of one level of detail (see mesh_lod.hpp)
+struct MeshLod
+{
+	std::uint32_t firstIndex, indexCount;
+	float error; // geometric deviation from the full-detail mesh
+};
+
+struct BoundingSphere
+{
+	Vec3f center;
+	float radius;
+};
+
+// Spatial part of a mesh with its own LOD chain (see build_lod_chunks()).
+// The level of detail is picked per chunk, so that parts of a large mesh
+// (e.g., a terrain) that are far from the camera can be drawn coarser than
+// the parts near it.
+struct MeshChunk
+{
+	BoundingSphere bounds;
+	std::uint32_t firstLod, lodCount; // range of the mesh's lods
+};
 
 struct SimpleMeshData
 {
@@ -14,11 +41,107 @@ struct SimpleMeshData
 	std::vector<Vec3f> colors;
 	std::vector<Vec3f> normals;
 	std::vector<Vec2f> texcoords;
+
+	// Optional index buffer. If empty, the mesh is a plain triangle soup.
+	std::vector<std::uint32_t> indices;
+
+	// Optional LOD chain, finest level first. Each level is a range of
+	// indices. If empty, all indices form a single level.
+	std::vector<MeshLod> lods;
+
+	// Optional chunks, each with its own chain in lods (finest level
+	// first). The full-detail levels of all chunks are stored first in
+	// indices, one after another. If empty, the mesh is a single chunk.
+	std::vector<MeshChunk> chunks;
+};
+
+// Vertex buffer layout used by create_vao()
+enum class VertexLayout
+{
+	// One buffer per attribute (positions, colors, normals, texcoords)
+	separate,
+
+	// A single buffer with all attributes of a vertex stored next to each
+	// other. Set up with glVertexAttribFormat()/glBindVertexBuffer().
+	interleaved
+};
+
+// Per-vertex record of the interleaved layout, as stored in the vertex
+// buffer (and in interleaved .smesh files)
+struct InterleavedVertex
+{
+	Vec3f position;
+	Vec3f color;
+	Vec3f normal;
+	Vec2f texcoord;
 };
 
+static_assert( sizeof(InterleavedVertex) == 11 * sizeof(float), "InterleavedVertex must be packed" );
+
+// GPU buffers holding a mesh. Buffer objects can be shared between GL
+// contexts, whereas vertex array objects can not. Meshes can therefore be
+// uploaded in one context (see asset_loader.hpp) and the VAO created in the
+// context that draws them.
+struct SimpleMeshBuffers
+{
+	VertexLayout layout = VertexLayout::separate;
+
+	// separate: positions, colors, normals, texcoords
+	// interleaved: only vertexBuffers[0] is used
+	GLuint vertexBuffers[4] = {};
+
+	GLuint indexBuffer = 0; // zero for non-indexed meshes
+
+	std::size_t vertexCount = 0;
+	std::size_t indexCount = 0; // all levels
+
+	// At least one level (covering all indices, if the mesh has no chain)
+	std::vector<MeshLod> lods;
+
+	// At least one chunk (covering all lods, if the mesh has no chunks)
+	std::vector<MeshChunk> chunks;
+
+	BoundingSphere bounds{};
+};
+
+// Append the second mesh to the first. Neither may have an LOD chain.
 SimpleMeshData concatenate( SimpleMeshData, SimpleMeshData const& );
 
+// Sphere around the bounding box of the positions. aStride is the distance
+// between consecutive positions in bytes.
+BoundingSphere compute_bounding_sphere( Vec3f const* aPositions, std::size_t aCount, std::size_t aStride = sizeof(Vec3f) );
+
+// The mesh's vertices in the interleaved layout. Streams may be shorter
+// than the position stream (see e.g. create_rectangle()); missing
+// attributes are zero.
+std::vector<InterleavedVertex> interleave_vertices( SimpleMeshData const& );
+
 GLuint create_rectangle(const Vec3f& topLeft, const Vec3f& topRight, const Vec3f& bottomLeft, const Vec3f& bottomRight, SimpleMeshData& rectangle);
-GLuint create_vao( SimpleMeshData const& );
+GLuint create_vao( SimpleMeshData const&, VertexLayout = VertexLayout::separate );
+
+// As create_vao(), but additionally uploads the mesh's indices into an
+// element buffer that is bound to the VAO. Draw with glDrawElements() and
+// GL_UNSIGNED_INT indices.
+GLuint create_indexed_vao( SimpleMeshData const&, VertexLayout = VertexLayout::separate );
+
+// Upload the mesh's vertex data (and indices, if any) without creating a VAO
+SimpleMeshBuffers create_mesh_buffers( SimpleMeshData const&, VertexLayout = VertexLayout::separate );
+
+// Delete the buffers (VAOs created for them must no longer be used)
+void delete_mesh_buffers( SimpleMeshBuffers const& );
+
+// Size of the buffers' contents in bytes
+std::size_t mesh_buffer_bytes( SimpleMeshBuffers const& );
+
+// Create a VAO for previously uploaded buffers. The element buffer, if any,
+// is bound to the VAO.
+GLuint create_vao( SimpleMeshBuffers const& );
+
+// Turn a VAO from create_vao()/create_indexed_vao() into an instanced one:
+// uploads one model-to-world transform per instance and binds it to vertex
+// attributes 4-7 (one matrix column each) with an attribute divisor of one.
+// Draw with glDrawArraysInstanced()/glDrawElementsInstanced(), passing
+// aModel2World.size() as the instance count. Returns the instance buffer.
+GLuint create_instance_buffer( GLuint aVao, std::vector<Mat44f> const& aModel2World );
 
 #endif // SIMPLE_MESH_HPP_C6B749D6_C83B_434C_9E58_F05FC27FEFC9
@@ -0,0 +1,424 @@
+#include "smesh.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../support/error.hpp"
+
+namespace {
+constexpr char kSmeshMagic_[4] = {'S', 'M', 'S', 'H'};
+constexpr std::uint32_t kSmeshVersion_ = 4;
+
+// Version 1 files end after the indices, and have no LOD count in the
+// header. Version 2 files have no layout; their vertices are separate.
+// Files before version 4 have no chunks.
+struct SmeshHeader_ {
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t vertexCount;
+  std::uint32_t indexCount;
+  std::uint32_t lodCount;   // version 2
+  std::uint32_t layout;     // version 3
+  std::uint32_t chunkCount; // version 4
+};
+
+constexpr std::size_t kSmeshHeaderSizeV1_ = 16;
+constexpr std::size_t kSmeshHeaderSizeV2_ = 20;
+constexpr std::size_t kSmeshHeaderSizeV3_ = 24;
+
+constexpr std::uint32_t kSmeshSeparate_ = 0;
+constexpr std::uint32_t kSmeshInterleaved_ = 1;
+
+static_assert(sizeof(SmeshHeader_) == 28, "unexpected padding in header");
+static_assert(sizeof(MeshLod) == 12, "MeshLod must be packed");
+static_assert(sizeof(MeshChunk) == 24, "MeshChunk must be packed");
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Vec3f must be packed");
+static_assert(sizeof(Vec2f) == 2 * sizeof(float), "Vec2f must be packed");
+
+// Pointers into the blobs of a .smesh file. Depending on the layout,
+// either vertices or the four separate streams are set.
+struct SmeshView_ {
+  std::uint32_t vertexCount, indexCount, lodCount, chunkCount;
+  VertexLayout layout;
+
+  InterleavedVertex const *vertices;
+  Vec3f const *positions;
+  Vec3f const *colors;
+  Vec3f const *normals;
+  Vec2f const *texcoords;
+  std::uint32_t const *indices;
+  MeshLod const *lods;
+  MeshChunk const *chunks;
+};
+
+SmeshView_ parse_smesh_(char const *aPath, void const *aData,
+                        std::size_t aSize);
+
+// Copy of the blobs
+SimpleMeshData copy_smesh_(SmeshView_ const &aView);
+
+// Read-only memory mapping of a whole file
+class MappedFile_ {
+public:
+  explicit MappedFile_(char const *aPath);
+  ~MappedFile_();
+
+  MappedFile_(MappedFile_ const &) = delete;
+  MappedFile_ &operator=(MappedFile_ const &) = delete;
+
+  void const *data() const noexcept { return mData; }
+  std::size_t size() const noexcept { return mSize; }
+
+private:
+  void const *mData = nullptr;
+  std::size_t mSize = 0;
+
+#if defined(_WIN32)
+  HANDLE mFile = INVALID_HANDLE_VALUE;
+  HANDLE mMapping = nullptr;
+#endif
+};
+} // namespace
+
+void save_smesh(char const *aPath, SimpleMeshData const &aMesh,
+                VertexLayout aLayout) {
+  auto const vertexCount = aMesh.positions.size();
+
+  if (aMesh.colors.size() != vertexCount ||
+      aMesh.normals.size() != vertexCount ||
+      aMesh.texcoords.size() != vertexCount) {
+    throw Error("save_smesh(): '%s': attribute streams differ in length",
+                aPath);
+  }
+
+  std::vector<std::uint32_t> sequential;
+  auto const *indices = &aMesh.indices;
+  if (aMesh.indices.empty()) {
+    sequential.resize(vertexCount);
+    for (std::size_t i = 0; i < vertexCount; ++i)
+      sequential[i] = std::uint32_t(i);
+    indices = &sequential;
+  }
+
+  SmeshHeader_ header{};
+  std::memcpy(header.magic, kSmeshMagic_, sizeof(header.magic));
+  header.version = kSmeshVersion_;
+  header.vertexCount = std::uint32_t(vertexCount);
+  header.indexCount = std::uint32_t(indices->size());
+  header.lodCount = std::uint32_t(aMesh.lods.size());
+  header.chunkCount = std::uint32_t(aMesh.chunks.size());
+  header.layout = VertexLayout::interleaved == aLayout ? kSmeshInterleaved_
+                                                       : kSmeshSeparate_;
+
+  std::vector<InterleavedVertex> interleaved;
+  if (VertexLayout::interleaved == aLayout)
+    interleaved = interleave_vertices(aMesh);
+
+  std::FILE *fout = std::fopen(aPath, "wb");
+  if (!fout)
+    throw Error("save_smesh(): unable to open '%s' for writing", aPath);
+
+  bool ok = 1 == std::fwrite(&header, sizeof(header), 1, fout);
+  if (VertexLayout::interleaved == aLayout) {
+    ok = ok && vertexCount == std::fwrite(interleaved.data(),
+                                          sizeof(InterleavedVertex),
+                                          vertexCount, fout);
+  } else {
+    ok = ok && vertexCount == std::fwrite(aMesh.positions.data(),
+                                          sizeof(Vec3f), vertexCount, fout);
+    ok = ok && vertexCount == std::fwrite(aMesh.colors.data(), sizeof(Vec3f),
+                                          vertexCount, fout);
+    ok = ok && vertexCount == std::fwrite(aMesh.normals.data(), sizeof(Vec3f),
+                                          vertexCount, fout);
+    ok = ok && vertexCount == std::fwrite(aMesh.texcoords.data(),
+                                          sizeof(Vec2f), vertexCount, fout);
+  }
+  ok = ok && indices->size() == std::fwrite(indices->data(),
+                                            sizeof(std::uint32_t),
+                                            indices->size(), fout);
+  ok = ok && aMesh.lods.size() == std::fwrite(aMesh.lods.data(), sizeof(MeshLod),
+                                              aMesh.lods.size(), fout);
+  ok = ok && aMesh.chunks.size() == std::fwrite(aMesh.chunks.data(),
+                                                sizeof(MeshChunk),
+                                                aMesh.chunks.size(), fout);
+
+  if (0 != std::fclose(fout))
+    ok = false;
+
+  if (!ok)
+    throw Error("save_smesh(): error while writing '%s'", aPath);
+}
+
+SimpleMeshData load_smesh(char const *aPath) {
+  MappedFile_ file(aPath);
+  return copy_smesh_(parse_smesh_(aPath, file.data(), file.size()));
+}
+
+SimpleMeshBuffers load_smesh_buffers(char const *aPath, VertexLayout aLayout) {
+  MappedFile_ file(aPath);
+  auto const view = parse_smesh_(aPath, file.data(), file.size());
+
+  // Converting between the layouts needs a copy of the vertices anyway
+  if (aLayout != view.layout)
+    return create_mesh_buffers(copy_smesh_(view), aLayout);
+
+  // Upload straight from the mapping
+  SimpleMeshBuffers buffers;
+  buffers.layout = aLayout;
+  buffers.vertexCount = view.vertexCount;
+  buffers.indexCount = view.indexCount;
+
+  buffers.lods.assign(view.lods, view.lods + view.lodCount);
+  if (buffers.lods.empty())
+    buffers.lods.push_back({0, view.indexCount, 0.f});
+
+  if (VertexLayout::interleaved == view.layout) {
+    buffers.bounds =
+        compute_bounding_sphere(&view.vertices->position, view.vertexCount,
+                                sizeof(InterleavedVertex));
+
+    glGenBuffers(1, buffers.vertexBuffers);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexCount * sizeof(InterleavedVertex),
+                 view.vertices, GL_STATIC_DRAW);
+  } else {
+    buffers.bounds = compute_bounding_sphere(view.positions, view.vertexCount);
+
+    glGenBuffers(4, buffers.vertexBuffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexCount * sizeof(Vec3f),
+                 view.positions, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexCount * sizeof(Vec3f),
+                 view.colors, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffers[2]);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexCount * sizeof(Vec3f),
+                 view.normals, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexBuffers[3]);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexCount * sizeof(Vec2f),
+                 view.texcoords, GL_STATIC_DRAW);
+  }
+
+  buffers.chunks.assign(view.chunks, view.chunks + view.chunkCount);
+  if (buffers.chunks.empty())
+    buffers.chunks.push_back(
+        {buffers.bounds, 0, std::uint32_t(buffers.lods.size())});
+
+  glGenBuffers(1, &buffers.indexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               view.indexCount * sizeof(std::uint32_t), view.indices,
+               GL_STATIC_DRAW);
+
+  return buffers;
+}
+
+GLuint load_smesh_vao(char const *aPath, std::size_t &aIndexCount,
+                      VertexLayout aLayout) {
+  auto const buffers = load_smesh_buffers(aPath, aLayout);
+
+  // The full-detail levels of the chunks come first
+  aIndexCount = 0;
+  for (auto const &chunk : buffers.chunks)
+    aIndexCount += buffers.lods[chunk.firstLod].indexCount;
+  return create_vao(buffers);
+}
+
+namespace {
+SmeshView_ parse_smesh_(char const *aPath, void const *aData,
+                        std::size_t aSize) {
+  auto const *bytes = static_cast<unsigned char const *>(aData);
+
+  SmeshHeader_ header{};
+  if (aSize < kSmeshHeaderSizeV1_)
+    throw Error("'%s' is not a .smesh file (too short)", aPath);
+
+  std::memcpy(&header, bytes, kSmeshHeaderSizeV1_);
+  if (0 != std::memcmp(header.magic, kSmeshMagic_, sizeof(header.magic)))
+    throw Error("'%s' is not a .smesh file (bad magic)", aPath);
+  if (header.version < 1 || header.version > kSmeshVersion_)
+    throw Error("'%s': unsupported .smesh version %u", aPath,
+                unsigned(header.version));
+
+  std::size_t headerBytes = kSmeshHeaderSizeV1_;
+  if (2 == header.version)
+    headerBytes = kSmeshHeaderSizeV2_;
+  else if (3 == header.version)
+    headerBytes = kSmeshHeaderSizeV3_;
+  else if (header.version >= 4)
+    headerBytes = sizeof(header);
+
+  if (aSize < headerBytes)
+    throw Error("'%s' is not a .smesh file (too short)", aPath);
+  std::memcpy(&header, bytes, headerBytes);
+
+  if (kSmeshSeparate_ != header.layout && kSmeshInterleaved_ != header.layout)
+    throw Error("'%s': unknown .smesh vertex layout %u", aPath,
+                unsigned(header.layout));
+
+  // Both layouts store the same attributes
+  std::size_t const vertexBytes =
+      std::size_t(header.vertexCount) * sizeof(InterleavedVertex);
+  std::size_t const indexBytes =
+      std::size_t(header.indexCount) * sizeof(std::uint32_t);
+  std::size_t const lodBytes = std::size_t(header.lodCount) * sizeof(MeshLod);
+  std::size_t const chunkBytes =
+      std::size_t(header.chunkCount) * sizeof(MeshChunk);
+
+  std::size_t const expected =
+      headerBytes + vertexBytes + indexBytes + lodBytes + chunkBytes;
+  if (aSize != expected)
+    throw Error("'%s': .smesh size mismatch (%zu bytes, expected %zu)", aPath,
+                aSize, expected);
+
+  // All blobs are multiples of four bytes, as are all header sizes, so the
+  // pointers below are suitably aligned for floats and uint32s.
+  SmeshView_ view{};
+  view.vertexCount = header.vertexCount;
+  view.indexCount = header.indexCount;
+  view.lodCount = header.lodCount;
+  view.chunkCount = header.chunkCount;
+  view.layout = kSmeshInterleaved_ == header.layout ? VertexLayout::interleaved
+                                                    : VertexLayout::separate;
+
+  auto const *ptr = bytes + headerBytes;
+  if (VertexLayout::interleaved == view.layout) {
+    view.vertices = reinterpret_cast<InterleavedVertex const *>(ptr);
+    ptr += header.vertexCount * sizeof(InterleavedVertex);
+  } else {
+    view.positions = reinterpret_cast<Vec3f const *>(ptr);
+    ptr += header.vertexCount * sizeof(Vec3f);
+    view.colors = reinterpret_cast<Vec3f const *>(ptr);
+    ptr += header.vertexCount * sizeof(Vec3f);
+    view.normals = reinterpret_cast<Vec3f const *>(ptr);
+    ptr += header.vertexCount * sizeof(Vec3f);
+    view.texcoords = reinterpret_cast<Vec2f const *>(ptr);
+    ptr += header.vertexCount * sizeof(Vec2f);
+  }
+  view.indices = reinterpret_cast<std::uint32_t const *>(ptr);
+  ptr += header.indexCount * sizeof(std::uint32_t);
+  view.lods = reinterpret_cast<MeshLod const *>(ptr);
+  ptr += header.lodCount * sizeof(MeshLod);
+  view.chunks = reinterpret_cast<MeshChunk const *>(ptr);
+
+  for (std::uint32_t i = 0; i < view.lodCount; ++i) {
+    if (std::size_t(view.lods[i].firstIndex) + view.lods[i].indexCount >
+        view.indexCount)
+      throw Error("'%s': LOD %u exceeds the index buffer", aPath, unsigned(i));
+  }
+
+  for (std::uint32_t i = 0; i < view.chunkCount; ++i) {
+    if (0 == view.chunks[i].lodCount ||
+        std::size_t(view.chunks[i].firstLod) + view.chunks[i].lodCount >
+            view.lodCount)
+      throw Error("'%s': chunk %u exceeds the LOD table", aPath, unsigned(i));
+  }
+
+  return view;
+}
+
+SimpleMeshData copy_smesh_(SmeshView_ const &aView) {
+  SimpleMeshData ret;
+  if (VertexLayout::interleaved == aView.layout) {
+    ret.positions.resize(aView.vertexCount);
+    ret.colors.resize(aView.vertexCount);
+    ret.normals.resize(aView.vertexCount);
+    ret.texcoords.resize(aView.vertexCount);
+    for (std::uint32_t i = 0; i < aView.vertexCount; ++i) {
+      ret.positions[i] = aView.vertices[i].position;
+      ret.colors[i] = aView.vertices[i].color;
+      ret.normals[i] = aView.vertices[i].normal;
+      ret.texcoords[i] = aView.vertices[i].texcoord;
+    }
+  } else {
+    ret.positions.assign(aView.positions, aView.positions + aView.vertexCount);
+    ret.colors.assign(aView.colors, aView.colors + aView.vertexCount);
+    ret.normals.assign(aView.normals, aView.normals + aView.vertexCount);
+    ret.texcoords.assign(aView.texcoords, aView.texcoords + aView.vertexCount);
+  }
+  ret.indices.assign(aView.indices, aView.indices + aView.indexCount);
+  ret.lods.assign(aView.lods, aView.lods + aView.lodCount);
+  ret.chunks.assign(aView.chunks, aView.chunks + aView.chunkCount);
+  return ret;
+}
+
+#if defined(_WIN32)
+MappedFile_::MappedFile_(char const *aPath) {
+  mFile = CreateFileA(aPath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (INVALID_HANDLE_VALUE == mFile)
+    throw Error("Unable to open '%s'", aPath);
+
+  LARGE_INTEGER size{};
+  GetFileSizeEx(mFile, &size);
+  mSize = std::size_t(size.QuadPart);
+
+  if (0 == mSize)
+    return;
+
+  mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mMapping)
+    mData = MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (!mData) {
+    if (mMapping)
+      CloseHandle(mMapping);
+    CloseHandle(mFile);
+    throw Error("Unable to map '%s'", aPath);
+  }
+}
+
+MappedFile_::~MappedFile_() {
+  if (mData)
+    UnmapViewOfFile(mData);
+  if (mMapping)
+    CloseHandle(mMapping);
+  if (INVALID_HANDLE_VALUE != mFile)
+    CloseHandle(mFile);
+}
+#else
+MappedFile_::MappedFile_(char const *aPath) {
+  int const fd = open(aPath, O_RDONLY);
+  if (-1 == fd)
+    throw Error("Unable to open '%s'", aPath);
+
+  struct stat st {};
+  if (0 != fstat(fd, &st)) {
+    close(fd);
+    throw Error("Unable to stat '%s'", aPath);
+  }
+
+  mSize = std::size_t(st.st_size);
+
+  if (mSize) {
+    void *ptr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == ptr) {
+      close(fd);
+      throw Error("Unable to map '%s'", aPath);
+    }
+    mData = ptr;
+  }
+
+  // The mapping remains valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile_::~MappedFile_() {
+  if (mData)
+    munmap(const_cast<void *>(mData), mSize);
+}
+#endif
+} // namespace
@@ -0,0 +1,58 @@
+#ifndef SMESH_HPP_5A1C7E2B_3F4D_4B8A_9C6E_2D7B1F0A8E43
+#define SMESH_HPP_5A1C7E2B_3F4D_4B8A_9C6E_2D7B1F0A8E43
+
+#include <glad.h>
+
+#include <cstddef>
+
+#include "simple_mesh.hpp"
+
+/* Pre-baked binary mesh format (.smesh)
+ *
+ * A .smesh file stores an indexed SimpleMeshData as ready-to-upload blobs,
+ * so that loading it involves no text parsing at all. Layout (little endian):
+ *
+ *   header     28 bytes: "SMSH", version, vertex count, index count,
+ *              LOD count, vertex layout (0 separate, 1 interleaved),
+ *              chunk count
+ *   vertices   separate:    positions   vertexCount * Vec3f
+ *                           colors      vertexCount * Vec3f
+ *                           normals     vertexCount * Vec3f
+ *                           texcoords   vertexCount * Vec2f
+ *              interleaved: vertexCount * InterleavedVertex
+ *   indices    indexCount * std::uint32_t (all levels)
+ *   lods       lodCount * MeshLod
+ *   chunks     chunkCount * MeshChunk
+ *
+ * Version 1 (16-byte header, no LOD table) and version 2 (20-byte header,
+ * without the layout) files are still read; their vertices are separate.
+ * Version 3 files (24-byte header) have no chunks.
+ *
+ * Use the loadobj tool to convert .obj (+ .mtl) files to .smesh.
+ */
+
+// Write the mesh to a .smesh file, with its vertices in the given layout.
+// Non-indexed meshes are stored with sequential indices.
+void save_smesh( char const* aPath, SimpleMeshData const&,
+                 VertexLayout = VertexLayout::separate );
+
+// Read a .smesh file into a SimpleMeshData (for meshes that need further
+// processing on the CPU).
+SimpleMeshData load_smesh( char const* aPath );
+
+// Map a .smesh file into memory and upload its blobs directly into new
+// buffer objects (see create_mesh_buffers()).
+//
+// Only the layout that the file was saved with is uploaded without a copy.
+// Requesting the other layout goes through load_smesh() and
+// create_mesh_buffers().
+SimpleMeshBuffers load_smesh_buffers( char const* aPath,
+                                      VertexLayout = VertexLayout::separate );
+
+// As load_smesh_buffers(), and create a VAO for the buffers. The number of
+// indices of the full-detail level (of all chunks) is returned via
+// aIndexCount.
+GLuint load_smesh_vao( char const* aPath, std::size_t& aIndexCount,
+                       VertexLayout = VertexLayout::separate );
+
+#endif // SMESH_HPP_5A1C7E2B_3F4D_4B8A_9C6E_2D7B1F0A8E43
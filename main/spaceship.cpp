@@ -11,10 +11,7 @@
 
 // rendering a spaceship
 void Spaceship::render(Mat44f projCameraWorld) {
-  ShaderProgram prog({{GL_VERTEX_SHADER, "assets/spaceship.vert"},
-                      {GL_FRAGMENT_SHADER, "assets/spaceship.frag"}});
-
-  glUseProgram(prog.programId());
+  glUseProgram(spaceshipProgram->programId());
 
   Vec3f lightDir = normalize(Vec3f{0.f, 1.f, -1.f});
   glUniform3fv(5, 1, &lightDir.x);
@@ -111,4 +108,8 @@ Spaceship::Spaceship(std::size_t aSubdivs, Mat44f aPreTransform) {
   }
   numVertices = spaceship.positions.size();
   spaceshipVAO = create_vao(spaceship);
+
+  // Shared program, compiled on first use only
+  spaceshipProgram = &get_program({{GL_VERTEX_SHADER, "assets/spaceship.vert"},
+                                   {GL_FRAGMENT_SHADER, "assets/spaceship.frag"}});
 }
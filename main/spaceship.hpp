@@ -7,6 +7,8 @@
 
 #include "simple_mesh.hpp"
 
+#include "../support/program.hpp"
+
 #include "../vmlib/vec3.hpp"
 #include "../vmlib/mat44.hpp"
 
@@ -29,6 +31,7 @@ public:
 
 private:
 	GLuint spaceshipVAO;
+	ShaderProgram* spaceshipProgram;
 };
 
 
@@ -1,17 +1,21 @@
 #include "texture.hpp"
 
+#include <algorithm>
+
 #include <cassert>
+#include <cstring>
 
 #include <stb_image.h>
 
 #include "../support/error.hpp"
 
-GLuint load_texture_2d( char const* aPath )
+ImageRGBA8 load_image_rgba8( char const* aPath )
 {
 	assert( aPath );
 
 	// Load image
-	stbi_set_flip_vertically_on_load( true );
+	// (The per-thread setting keeps concurrent decodes independent)
+	stbi_set_flip_vertically_on_load_thread( true );
 
 	int w, h, channels;
 
@@ -20,28 +24,229 @@ GLuint load_texture_2d( char const* aPath )
 	if (!ptr)
 		throw Error("Unable to load image '%s'\n", aPath);
 
+	ImageRGBA8 ret;
+	ret.width = w;
+	ret.height = h;
+	ret.pixels.reset( ptr );
+
+	return ret;
+}
+
+void ImageRGBA8::PixelDeleter::operator()( unsigned char* aPixels ) const noexcept
+{
+	stbi_image_free( aPixels );
+}
+
+namespace
+{
+	void configure_texture_2d_()
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 6.f);
+	}
+}
+
+GLuint create_texture_2d( ImageRGBA8 const& aImage )
+{
 	// Generate texture object, init texture with image
 	GLuint tex = 0;
 	glGenTextures(1, &tex);
 	glBindTexture(GL_TEXTURE_2D, tex);
 
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, ptr );
-
-	stbi_image_free(ptr);
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, aImage.width, aImage.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, aImage.pixels.get() );
 
 	// Generate mipmap hiearchy
 	glGenerateMipmap(GL_TEXTURE_2D);
 
 	// Configure texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	configure_texture_2d_();
+
+	return tex;
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+GLuint create_texture_2d( CompressedImage const& aImage )
+{
+	GLuint tex = 0;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+
+	// Upload all levels; the mip chain is part of the image
+	for( std::size_t i = 0; i < aImage.levels.size(); ++i )
+	{
+		auto const& level = aImage.levels[i];
+		glCompressedTexImage2D( GL_TEXTURE_2D, GLint(i), aImage.format, level.width, level.height, 0, GLsizei(level.size), aImage.data.data() + level.offset );
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 6.f);
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(aImage.levels.size())-1 );
 
+	configure_texture_2d_();
 
 	return tex;
 }
 
+CompressedFormatSupport query_compressed_format_support()
+{
+	CompressedFormatSupport ret;
+
+	// BPTC is core since OpenGL 4.2
+	ret.bptc = GLAD_GL_VERSION_4_2;
+
+	// S3TC sRGB formats need EXT_texture_sRGB (or the newer
+	// EXT_texture_compression_s3tc_srgb) in addition to S3TC itself
+	bool s3tc = false, srgb = false;
+
+	GLint count = 0;
+	glGetIntegerv( GL_NUM_EXTENSIONS, &count );
+	for( GLint i = 0; i < count; ++i )
+	{
+		auto const* name = reinterpret_cast<char const*>(glGetStringi( GL_EXTENSIONS, GLuint(i) ));
+
+		if( 0 == std::strcmp( name, "GL_EXT_texture_compression_s3tc" ) )
+			s3tc = true;
+		else if( 0 == std::strcmp( name, "GL_EXT_texture_sRGB" ) || 0 == std::strcmp( name, "GL_EXT_texture_compression_s3tc_srgb" ) )
+			srgb = true;
+		else if( 0 == std::strcmp( name, "GL_ARB_texture_compression_bptc" ) )
+			ret.bptc = true;
+	}
+
+	ret.s3tc = s3tc && srgb;
+	return ret;
+}
+
+GLuint load_texture_2d( char const* aPath )
+{
+	auto const support = query_compressed_format_support();
+	if( support.s3tc || support.bptc )
+		return create_texture_2d( load_compressed_image( aPath, support ) );
+
+	return create_texture_2d( load_image_rgba8( aPath ) );
+}
+
+StreamingTexture::StreamingTexture( std::shared_ptr<CompressedImage const> aImage, std::size_t aTailBytes )
+	: mImage( std::move(aImage) )
+{
+	assert( mImage && !mImage->levels.empty() );
+
+	for( auto const& level : mImage->levels )
+		mBytes += level.size;
+
+	auto const& levels = mImage->levels;
+	GLsizei const levelCount = GLsizei(levels.size());
+
+	// Immutable storage for the whole chain; the base level can then be
+	// moved freely without the texture becoming incomplete.
+	glGenTextures( 1, &mTexture );
+	glBindTexture( GL_TEXTURE_2D, mTexture );
+	glTexStorage2D( GL_TEXTURE_2D, levelCount, mImage->format, mImage->width, mImage->height );
+
+	// Upload the tail of the chain right away (at least the last level)
+	mBaseLevel = levelCount;
+
+	std::size_t tailBytes = 0;
+	while( mBaseLevel > 0 )
+	{
+		auto const& level = levels[mBaseLevel-1];
+		if( mBaseLevel < levelCount && tailBytes + level.size > aTailBytes )
+			break;
+
+		--mBaseLevel;
+		tailBytes += level.size;
+
+		glCompressedTexSubImage2D( GL_TEXTURE_2D, mBaseLevel, 0, 0, level.width, level.height, mImage->format, GLsizei(level.size), mImage->data.data() + level.offset );
+	}
+
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mBaseLevel );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount-1 );
+
+	configure_texture_2d_();
+
+	glGenBuffers( 1, &mUnpackBuffer );
+
+	if( 0 == mBaseLevel )
+		mImage.reset();
+}
+
+StreamingTexture::~StreamingTexture()
+{
+	glDeleteBuffers( 1, &mUnpackBuffer );
+	glDeleteTextures( 1, &mTexture );
+}
+
+GLuint StreamingTexture::handle() const noexcept
+{
+	return mTexture;
+}
+
+bool StreamingTexture::complete() const noexcept
+{
+	return 0 == mBaseLevel;
+}
+
+std::size_t StreamingTexture::bytes() const noexcept
+{
+	return mBytes;
+}
+
+std::size_t StreamingTexture::stream( std::size_t aByteBudget )
+{
+	if( 0 == mBaseLevel )
+		return 0;
+
+	glBindTexture( GL_TEXTURE_2D, mTexture );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, mUnpackBuffer );
+
+	std::size_t uploaded = 0;
+	while( mBaseLevel > 0 && (0 == uploaded || uploaded < aByteBudget) )
+	{
+		int const index = mBaseLevel-1;
+		auto const& level = mImage->levels[index];
+
+		// Blocks are stored row by row, so any range of block rows is one
+		// contiguous range of bytes.
+		int const blockRows = (level.height+3) / 4;
+		std::size_t const rowBytes = level.size / std::size_t(blockRows);
+
+		std::size_t const remaining = aByteBudget > uploaded ? aByteBudget - uploaded : 0;
+		int const rows = std::min( blockRows - mNextBlockRow, std::max( 1, int(remaining / rowBytes) ) );
+
+		if( uploaded && remaining < rowBytes )
+			break;
+
+		std::size_t const bytes = rows * rowBytes;
+
+		// Re-specifying the buffer orphans the previous storage, so this
+		// does not wait for the preceding transfer to finish.
+		glBufferData( GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bytes), mImage->data.data() + level.offset + mNextBlockRow * rowBytes, GL_STREAM_DRAW );
+
+		int const y = mNextBlockRow * 4;
+		int const height = std::min( rows * 4, level.height - y );
+		glCompressedTexSubImage2D( GL_TEXTURE_2D, index, 0, y, level.width, height, mImage->format, GLsizei(bytes), nullptr );
+
+		uploaded += bytes;
+		mNextBlockRow += rows;
+
+		if( mNextBlockRow == blockRows )
+		{
+			mBaseLevel = index;
+			mNextBlockRow = 0;
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mBaseLevel );
+		}
+	}
+
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+	if( 0 == mBaseLevel )
+	{
+		// The CPU copy is no longer needed, nor is the staging buffer
+		mImage.reset();
+		glDeleteBuffers( 1, &mUnpackBuffer );
+		mUnpackBuffer = 0;
+	}
+
+	return uploaded;
+}
@@ -3,6 +3,90 @@
 
 #include <glad.h>
 
+#include <memory>
+
+#include <cstddef>
+
+#include "compressed_texture.hpp"
+
+// Decoded 8-bit RGBA image, rows stored bottom-up (OpenGL convention)
+struct ImageRGBA8
+{
+	struct PixelDeleter
+	{
+		void operator()( unsigned char* ) const noexcept;
+	};
+
+	int width = 0, height = 0;
+	std::unique_ptr<unsigned char[],PixelDeleter> pixels;
+};
+
+// Decode an image file. Does not use OpenGL, and may be called from any
+// thread.
+ImageRGBA8 load_image_rgba8( char const* aPath );
+
+// Create a mipmapped sRGB texture from a decoded image (current context)
+GLuint create_texture_2d( ImageRGBA8 const& );
+
+// Create a texture from a compressed image, using its precomputed mip levels
+// (current context)
+GLuint create_texture_2d( CompressedImage const& );
+
+// Query which compressed formats the current context supports
+CompressedFormatSupport query_compressed_format_support();
+
+// Load a mipmapped sRGB texture. Uses a block-compressed format (see
+// load_compressed_image()) if the context supports one, and falls back to
+// an uncompressed texture otherwise.
 GLuint load_texture_2d( char const* aPath );
 
+/* Texture whose mip levels are uploaded progressively
+ *
+ * On construction, only the small levels at the end of the mip chain (up to
+ * aTailBytes) are uploaded, so the texture can be used immediately. Each
+ * call to stream() then uploads the next finer level, a few rows of blocks
+ * at a time, through a pixel unpack buffer. GL_TEXTURE_BASE_LEVEL is
+ * lowered whenever a level is complete, so sampling never touches levels
+ * that are still being uploaded.
+ *
+ * All methods must be called from the thread of the owning context.
+ */
+class StreamingTexture final
+{
+	public:
+		explicit StreamingTexture(
+			std::shared_ptr<CompressedImage const>,
+			std::size_t aTailBytes = 256*1024
+		);
+		~StreamingTexture();
+
+		StreamingTexture( StreamingTexture const& ) = delete;
+		StreamingTexture& operator= (StreamingTexture const&) = delete;
+
+	public:
+		GLuint handle() const noexcept;
+
+		// True once all levels are resident
+		bool complete() const noexcept;
+
+		// GPU memory of the whole mip chain, which is allocated up front
+		std::size_t bytes() const noexcept;
+
+		// Upload up to aByteBudget bytes (but always at least one row of
+		// blocks, so that progress is made). Returns the number of bytes
+		// uploaded. Leaves the texture bound to GL_TEXTURE_2D.
+		std::size_t stream( std::size_t aByteBudget );
+
+	private:
+		std::shared_ptr<CompressedImage const> mImage; // released when complete
+
+		GLuint mTexture = 0;
+		GLuint mUnpackBuffer = 0;
+
+		std::size_t mBytes = 0;
+
+		int mBaseLevel = 0; // finest level that is fully resident
+		int mNextBlockRow = 0; // progress in level mBaseLevel-1
+};
+
 #endif // TEXTURE_HPP_D0746DED_C9C6_40CD_B6E0_C6FEF665DD31
@@ -0,0 +1,170 @@
+// Microbenchmark for the particle update kernels (see
+// main/particle_store.hpp). Runs the scalar and the SIMD kernel on the same
+// particles, and checks that both produce the same result. Then compares
+// the depth sort (see main/particle_sort.hpp) with std::sort.
+//
+// Usage: particle-bench [particles] [updates]
+//
+// Build the release configuration for meaningful numbers.
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <numeric>
+#include <random>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../main/particle_sort.hpp"
+#include "../main/particle_store.hpp"
+
+namespace {
+constexpr float kDeltaTime_ = 1.f / 1000.f;
+
+ParticleStore make_particles_(std::size_t aCount) {
+  ParticleStore ret(aCount);
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+  // Mostly active, with some that are about to die
+  for (std::size_t i = 0; i < aCount; ++i) {
+    ret.positionX[i] = unit(rng);
+    ret.positionY[i] = unit(rng);
+    ret.positionZ[i] = unit(rng);
+    ret.velocityX[i] = unit(rng);
+    ret.velocityY[i] = unit(rng);
+    ret.velocityZ[i] = unit(rng);
+    ret.rotation[i] = unit(rng);
+    ret.lifeTime[i] = 1.f;
+    ret.lifeRemaining[i] = 0.5f + 0.5f * unit(rng);
+    ret.active[i] = unit(rng) < 0.8f ? 1.f : 0.f;
+  }
+
+  return ret;
+}
+
+// Seconds per update
+double run_(ParticleStore &aStore, std::size_t aUpdates,
+            ParticleKernel aKernel) {
+  auto const start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < aUpdates; ++i)
+    update_particles(aStore, aStore.capacity(), kDeltaTime_, aKernel);
+  auto const end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count() / aUpdates;
+}
+
+// Seconds per sort of the particles by z, and whether both sorts agree
+struct SortTimes_ {
+  double radix, standard;
+  bool same;
+};
+
+SortTimes_ run_sorts_(ParticleStore const &aStore, std::size_t aCount,
+                      std::size_t aSorts) {
+  using Clock_ = std::chrono::steady_clock;
+
+  std::vector<std::uint32_t> keys(aCount), radix(aCount), standard(aCount);
+  RadixSortScratch scratch;
+
+  auto const start = Clock_::now();
+  for (std::size_t i = 0; i < aSorts; ++i) {
+    for (std::size_t j = 0; j < aCount; ++j)
+      keys[j] = float_sort_key(aStore.positionZ[j]);
+    radix_sort_indices(keys.data(), aCount, radix.data(), scratch);
+  }
+  auto const middle = Clock_::now();
+  for (std::size_t i = 0; i < aSorts; ++i) {
+    std::iota(standard.begin(), standard.end(), 0u);
+    std::stable_sort(standard.begin(), standard.end(),
+                     [&](std::uint32_t aLeft, std::uint32_t aRight) {
+                       return aStore.positionZ[aLeft] <
+                              aStore.positionZ[aRight];
+                     });
+  }
+  auto const end = Clock_::now();
+
+  return {std::chrono::duration<double>(middle - start).count() / aSorts,
+          std::chrono::duration<double>(end - middle).count() / aSorts,
+          radix == standard};
+}
+
+float max_difference_(ParticleFloats const &aLeft,
+                      ParticleFloats const &aRight) {
+  float ret = 0.f;
+  for (std::size_t i = 0; i < aLeft.size(); ++i)
+    ret = std::max(ret, std::abs(aLeft[i] - aRight[i]));
+  return ret;
+}
+} // namespace
+
+int main(int aArgc, char *aArgv[]) try {
+  if (aArgc > 3) {
+    std::fprintf(stderr, "Usage: %s [particles] [updates]\n", aArgv[0]);
+    return 2;
+  }
+
+  std::size_t const count =
+      aArgc > 1 ? std::strtoull(aArgv[1], nullptr, 10) : 1u << 20;
+  std::size_t const updates =
+      aArgc > 2 ? std::strtoull(aArgv[2], nullptr, 10) : 200;
+
+#if defined(_DEBUG)
+  std::printf("Note: debug build; timings are not representative\n");
+#endif
+
+  auto scalar = make_particles_(count);
+  auto simd = make_particles_(count);
+
+  double const scalarTime = run_(scalar, updates, ParticleKernel::scalar);
+  double const simdTime = run_(simd, updates, ParticleKernel::simd);
+
+  std::printf("%zu particles, %zu updates\n", count, updates);
+  std::printf("  scalar: %8.3f ms/update, %6.3f ns/particle\n",
+              scalarTime * 1e3, scalarTime * 1e9 / count);
+  std::printf("  %-6s: %8.3f ms/update, %6.3f ns/particle (%.2fx)\n",
+              particle_simd_name(), simdTime * 1e3, simdTime * 1e9 / count,
+              scalarTime / simdTime);
+
+  // Both kernels must agree (up to floating point contraction)
+  float const diff = std::max(
+      {max_difference_(scalar.positionX, simd.positionX),
+       max_difference_(scalar.positionY, simd.positionY),
+       max_difference_(scalar.positionZ, simd.positionZ),
+       max_difference_(scalar.rotation, simd.rotation),
+       max_difference_(scalar.lifeRemaining, simd.lifeRemaining),
+       max_difference_(scalar.active, simd.active)});
+
+  std::printf("  max. difference: %g\n", double(diff));
+
+  if (diff > 1e-4f) {
+    std::fprintf(stderr, "Kernels disagree\n");
+    return 1;
+  }
+
+  // Depth sort, far fewer iterations, as std::sort is slow
+  std::size_t const sorts = std::max<std::size_t>(1, updates / 20);
+  auto const sortTimes = run_sorts_(simd, count, sorts);
+
+  std::printf("%zu particles, %zu depth sorts\n", count, sorts);
+  std::printf("  std::stable_sort: %8.3f ms/sort\n", sortTimes.standard * 1e3);
+  std::printf("  radix sort:       %8.3f ms/sort (%.2fx)\n",
+              sortTimes.radix * 1e3, sortTimes.standard / sortTimes.radix);
+
+  if (!sortTimes.same) {
+    std::fprintf(stderr, "Sorts disagree\n");
+    return 1;
+  }
+
+  return 0;
+} catch (std::exception const &eErr) {
+  std::fprintf(stderr, "Top-level Exception (%s):\n", typeid(eErr).name());
+  std::fprintf(stderr, "%s\n", eErr.what());
+  std::fprintf(stderr, "Bye.\n");
+  return 1;
+}
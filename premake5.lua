@@ -93,6 +93,46 @@ project "main"
 
 	files( sources )
 
+project "loadobj"
+	local sources = { 
+		"loadobj/**.cpp",
+		"loadobj/**.hpp",
+		"main/loadobj.cpp",
+		"main/loadobj.hpp",
+		"main/mesh_lod.cpp",
+		"main/mesh_lod.hpp",
+		"main/mesh_optimize.cpp",
+		"main/mesh_optimize.hpp",
+		"main/simple_mesh.cpp",
+		"main/simple_mesh.hpp",
+		"main/smesh.cpp",
+		"main/smesh.hpp"
+	}
+
+	kind "ConsoleApp"
+	location "loadobj"
+
+	files( sources )
+
+	links "support"
+
+	links "x-glad"
+
+project "particle-bench"
+	local sources = { 
+		"particle-bench/**.cpp",
+		"particle-bench/**.hpp",
+		"main/particle_sort.cpp",
+		"main/particle_sort.hpp",
+		"main/particle_store.cpp",
+		"main/particle_store.hpp"
+	}
+
+	kind "ConsoleApp"
+	location "particle-bench"
+
+	files( sources )
+
 project "main-shaders"
 	local shaders = { 
 		"assets/*.vert",
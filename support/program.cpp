@@ -1,9 +1,17 @@
 #include "program.hpp"
 
+#include <string>
 #include <vector>
 #include <utility>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
 
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
@@ -13,11 +21,29 @@
 
 namespace
 {
-	GLuint load_shader_( 
+	std::vector<GLchar> read_source_( char const* aSourcePath );
+
+	GLuint compile_shader_( 
 		GLenum aShaderType, 
-		char const* aSourcePath
+		char const* aSourcePath,
+		std::vector<GLchar> const& aSource
 	);
 
+	// Program binary cache (see set_program_binary_cache())
+	std::string& binary_cache_dir_()
+	{
+		static std::string dir;
+		return dir;
+	}
+
+	std::string binary_cache_path_(
+		std::vector<ShaderProgram::ShaderSource> const&,
+		std::vector<std::vector<GLchar>> const&
+	);
+
+	GLuint load_program_binary_( std::string const& aCachePath );
+	void store_program_binary_( GLuint aProgram, std::string const& aCachePath );
+
 	// lightweight std::experimental::scope_exit alternative
 	// Not the most complete or convenient implementation...
 	template< typename tFunc >
@@ -35,6 +61,16 @@ namespace
 	{
 		return ScopeExit_<tFunc>( std::forward<tFunc>(aFunc) );
 	}
+
+	std::string registry_key_( std::vector<ShaderProgram::ShaderSource> const& );
+
+	// Node-based container: references to the programs remain valid when
+	// other programs are added.
+	std::unordered_map<std::string,ShaderProgram>& registry_()
+	{
+		static std::unordered_map<std::string,ShaderProgram> registry;
+		return registry;
+	}
 }
 
 ShaderProgram::ShaderProgram( std::vector<ShaderSource> aShaderSources )
@@ -68,6 +104,29 @@ GLuint ShaderProgram::programId() const noexcept
 
 void ShaderProgram::reload()
 {
+	// Read the shader sources. Their contents are needed both to compile the
+	// shaders and to identify a matching cached program binary.
+	std::vector<std::vector<GLchar>> sources;
+	sources.reserve( mSources.size() );
+
+	for( auto const& source : mSources )
+		sources.emplace_back( read_source_( source.sourcePath.c_str() ) );
+
+	// Try the program binary cache first. If the driver accepts the cached
+	// binary, there is no need to compile anything.
+	auto const cachePath = binary_cache_path_( mSources, sources );
+	if( !cachePath.empty() )
+	{
+		if( GLuint cached = load_program_binary_( cachePath ) )
+		{
+			std::swap( mProgram, cached );
+			if( 0 != cached )
+				glDeleteProgram( cached );
+
+			return;
+		}
+	}
+
 	// Space to hold the shaders when we load them
 	std::vector<GLuint> shaders;
 	shaders.reserve( mSources.size() );
@@ -79,9 +138,9 @@ void ShaderProgram::reload()
 			glDeleteShader( shader );
 	} );
 
-	// Load shaders
-	for( auto const& source : mSources )
-		shaders.emplace_back( load_shader_( source.type, source.sourcePath.c_str() ) );
+	// Compile shaders
+	for( std::size_t i = 0; i < mSources.size(); ++i )
+		shaders.emplace_back( compile_shader_( mSources[i].type, mSources[i].sourcePath.c_str(), sources[i] ) );
 
 	// Create program object
 	OGL_CHECKPOINT_ALWAYS();
@@ -107,6 +166,9 @@ void ShaderProgram::reload()
 	for( auto const shader : shaders )
 		glAttachShader( prog, shader );
 
+	if( !cachePath.empty() )
+		glProgramParameteri( prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
 	glLinkProgram( prog );
 
 	{
@@ -134,13 +196,53 @@ void ShaderProgram::reload()
 	
 	OGL_CHECKPOINT_ALWAYS();
 
+	if( !cachePath.empty() )
+		store_program_binary_( prog, cachePath );
+
 	// Replace the old shader program (if any) with the new one
 	std::swap( mProgram, prog );
 }
 
+void set_program_binary_cache( char const* aDirectory )
+{
+	binary_cache_dir_() = aDirectory ? aDirectory : "";
+}
+
+ShaderProgram& get_program( std::vector<ShaderProgram::ShaderSource> const& aSources )
+{
+	auto& registry = registry_();
+
+	auto key = registry_key_( aSources );
+	if( auto const it = registry.find( key ); registry.end() != it )
+		return it->second;
+
+	// Build the program before inserting it, so that a failed compile/link
+	// does not leave an empty entry behind.
+	ShaderProgram prog( aSources );
+	return registry.emplace( std::move(key), std::move(prog) ).first->second;
+}
+
+void clear_program_registry()
+{
+	registry_().clear();
+}
+
 namespace
 {
-	GLuint load_shader_( GLenum aShaderType, char const* aSourcePath )
+	std::string registry_key_( std::vector<ShaderProgram::ShaderSource> const& aSources )
+	{
+		std::string key;
+		for( auto const& source : aSources )
+		{
+			key += std::to_string( source.type );
+			key += ':';
+			key += source.sourcePath;
+			key += '\n';
+		}
+		return key;
+	}
+
+	std::vector<GLchar> read_source_( char const* aSourcePath )
 	{
 		// Load the shader source code from file
 		std::vector<GLchar> source;
@@ -163,9 +265,9 @@ namespace
 				if( 0 == ret )
 				{
 					if( auto const err = std::ferror( fin ) )
-						throw Error( "load_shader_(): error while reading from '%s': %d (%zu bytes read, %zu total)", aSourcePath, err, read, length );
+						throw Error( "read_source_(): error while reading from '%s': %d (%zu bytes read, %zu total)", aSourcePath, err, read, length );
 					if( std::feof( fin ) )
-						throw Error( "load_shader_(): unexpected EOF in '%s' (%zu bytes read, %zu total)", aSourcePath, read, length );
+						throw Error( "read_source_(): unexpected EOF in '%s' (%zu bytes read, %zu total)", aSourcePath, read, length );
 				}
 			
 				read += ret;
@@ -173,9 +275,14 @@ namespace
 		}
 		else
 		{
-			throw Error( "load_shader_(): unable to open input file '%s'", aSourcePath );
+			throw Error( "read_source_(): unable to open input file '%s'", aSourcePath );
 		}
 
+		return source;
+	}
+
+	GLuint compile_shader_( GLenum aShaderType, char const* aSourcePath, std::vector<GLchar> const& aSource )
+	{
 		// Create shader object
 		OGL_CHECKPOINT_ALWAYS();
 
@@ -183,10 +290,10 @@ namespace
 
 		// Compile shader
 		GLchar const* sources[] = {
-			source.data()
+			aSource.data()
 		};
 		GLsizei lengths[] = {
-			GLsizei(source.size())
+			GLsizei(aSource.size())
 		};
 
 		glShaderSource( shader, sizeof(sources)/sizeof(sources[0]), sources, lengths );
@@ -238,4 +345,175 @@ namespace
 
 		return shader;
 	}
+
+	// Cached program binaries are keyed by a 64-bit FNV-1a hash over the GL
+	// implementation strings and the shader sources. A driver update changes
+	// the version string, and with it the key, so stale binaries are simply
+	// never looked up again.
+	struct Fnv1a64_
+	{
+		std::uint64_t value = 14695981039346656037ull;
+
+		void add( void const* aData, std::size_t aSize )
+		{
+			auto const* bytes = static_cast<unsigned char const*>(aData);
+			for( std::size_t i = 0; i < aSize; ++i )
+			{
+				value ^= bytes[i];
+				value *= 1099511628211ull;
+			}
+		}
+		void add( char const* aString )
+		{
+			// Include the terminator, so that "ab"+"c" and "a"+"bc" differ
+			add( aString, aString ? std::strlen( aString )+1 : 0 );
+		}
+	};
+
+	struct ProgramBinaryHeader_
+	{
+		char magic[4];
+		std::uint32_t format;
+		std::uint32_t size;
+	};
+
+	constexpr char kProgramBinaryMagic_[4] = { 'S', 'P', 'B', '1' };
+
+	std::string binary_cache_path_( std::vector<ShaderProgram::ShaderSource> const& aSources, std::vector<std::vector<GLchar>> const& aContents )
+	{
+		auto const& dir = binary_cache_dir_();
+		if( dir.empty() )
+			return {};
+
+		GLint formatCount = 0;
+		glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount );
+		if( formatCount <= 0 )
+			return {};
+
+		Fnv1a64_ hash;
+		hash.add( reinterpret_cast<char const*>(glGetString( GL_VENDOR )) );
+		hash.add( reinterpret_cast<char const*>(glGetString( GL_RENDERER )) );
+		hash.add( reinterpret_cast<char const*>(glGetString( GL_VERSION )) );
+
+		for( std::size_t i = 0; i < aSources.size(); ++i )
+		{
+			GLenum const type = aSources[i].type;
+			std::uint64_t const size = aContents[i].size();
+
+			hash.add( &type, sizeof(type) );
+			hash.add( &size, sizeof(size) );
+			hash.add( aContents[i].data(), aContents[i].size() );
+		}
+
+		char name[32];
+		std::snprintf( name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash.value) );
+
+		return (std::filesystem::path( dir ) / name).string();
+	}
+
+	GLuint load_program_binary_( std::string const& aCachePath )
+	{
+		std::FILE* fin = std::fopen( aCachePath.c_str(), "rb" );
+		if( !fin )
+			return 0;
+
+		auto const scopeFile_ = scope_exit_( [&fin] {
+			std::fclose( fin );
+		} );
+
+		ProgramBinaryHeader_ header{};
+		if( 1 != std::fread( &header, sizeof(header), 1, fin ) || 0 != std::memcmp( header.magic, kProgramBinaryMagic_, sizeof(header.magic) ) )
+			return 0;
+
+		std::vector<unsigned char> binary( header.size );
+		if( binary.empty() || binary.size() != std::fread( binary.data(), 1, binary.size(), fin ) )
+			return 0;
+
+		// glProgramBinary() raises GL_INVALID_ENUM for formats that the
+		// implementation does not know. Check beforehand, so that a stale
+		// cache does not trip the next OGL_CHECKPOINT.
+		GLint formatCount = 0;
+		glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount );
+
+		std::vector<GLint> formats( std::size_t(std::max( formatCount, 0 )) );
+		if( !formats.empty() )
+			glGetIntegerv( GL_PROGRAM_BINARY_FORMATS, formats.data() );
+
+		if( formats.end() == std::find( formats.begin(), formats.end(), GLint(header.format) ) )
+			return 0;
+
+		GLuint prog = glCreateProgram();
+		glProgramBinary( prog, header.format, binary.data(), GLsizei(binary.size()) );
+
+		// The driver may reject a binary for any reason (e.g., a changed
+		// configuration). In that case, we fall back to the sources.
+		GLint status = 0;
+		glGetProgramiv( prog, GL_LINK_STATUS, &status );
+
+		if( GL_TRUE != status )
+		{
+			std::fprintf( stderr, "Note: cached program binary '%s' was rejected; recompiling\n", aCachePath.c_str() );
+			glDeleteProgram( prog );
+			return 0;
+		}
+
+		return prog;
+	}
+
+	void store_program_binary_( GLuint aProgram, std::string const& aCachePath )
+	{
+		GLint length = 0;
+		glGetProgramiv( aProgram, GL_PROGRAM_BINARY_LENGTH, &length );
+		if( length <= 0 )
+			return;
+
+		std::vector<unsigned char> binary( static_cast<std::size_t>(length) );
+
+		GLenum format = 0;
+		glGetProgramBinary( aProgram, length, &length, &format, binary.data() );
+		binary.resize( std::size_t(length) );
+
+		// The cache is an optimization only. Failing to write it is not an
+		// error, so report any problems and carry on.
+		std::error_code ec;
+		std::filesystem::create_directories( std::filesystem::path( aCachePath ).parent_path(), ec );
+
+		// Write to a temporary file first and rename it into place, so that
+		// concurrently starting instances never see a partial binary. Each
+		// writer needs its own temporary file for this; the random part and
+		// the clock keep instances on other machines sharing the directory
+		// apart. The rename replaces the cache file as a whole, and the last
+		// writer wins.
+		std::random_device random;
+		char suffix[40];
+		std::snprintf( suffix, sizeof(suffix), ".%08x%08x.tmp", unsigned(random()),
+			unsigned(std::chrono::steady_clock::now().time_since_epoch().count()) );
+		auto const tempPath = aCachePath + suffix;
+
+		std::FILE* fout = std::fopen( tempPath.c_str(), "wb" );
+		if( !fout )
+		{
+			std::fprintf( stderr, "Note: unable to write program binary cache '%s'\n", tempPath.c_str() );
+			return;
+		}
+
+		ProgramBinaryHeader_ header{};
+		std::memcpy( header.magic, kProgramBinaryMagic_, sizeof(header.magic) );
+		header.format = format;
+		header.size = std::uint32_t(binary.size());
+
+		bool const ok = 1 == std::fwrite( &header, sizeof(header), 1, fout )
+			&& binary.size() == std::fwrite( binary.data(), 1, binary.size(), fout );
+
+		std::fclose( fout );
+
+		if( ok )
+			std::filesystem::rename( tempPath, aCachePath, ec );
+
+		if( !ok || ec )
+		{
+			std::fprintf( stderr, "Note: unable to write program binary cache '%s'\n", aCachePath.c_str() );
+			std::filesystem::remove( tempPath, ec );
+		}
+	}
 }
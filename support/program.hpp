@@ -41,4 +41,22 @@ class ShaderProgram final
 		std::vector<ShaderSource> mSources;
 };
 
+// Process-wide program registry. Each unique list of shader sources is
+// compiled and linked once; later requests with the same list return the
+// existing program. The returned reference stays valid until the registry is
+// cleared.
+//
+// Call clear_program_registry() while the GL context is still current, as it
+// deletes all registered programs.
+ShaderProgram& get_program( std::vector<ShaderProgram::ShaderSource> const& );
+
+void clear_program_registry();
+
+// Enable the on-disk program binary cache. ShaderProgram::reload() stores
+// linked programs (glGetProgramBinary()) in the given directory and reuses
+// them (glProgramBinary()) when the shader sources and the GL implementation
+// are unchanged. Rejected binaries fall back to compiling from source.
+// Pass nullptr to disable the cache (default).
+void set_program_binary_cache( char const* aDirectory );
+
 #endif // PROGRAM_HPP_39793FD2_7845_47A7_9E21_6DDAD42C9A09